@@ -0,0 +1,1393 @@
+/* Host benchmark of the stub packet engine.
+
+   Copyright (C) 2022 Empathic Qubit.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* Replays typical RSP sessions against the stub compiled for the host and
+   reports bytes on the wire and host CPU time spent per session. Every
+   reply is decoded and checked, so the program fails if the stub produces
+   broken packets or wrong data.
+
+   Usage: bench [-a] [-n iterations]
+     -a  negotiate QStartNoAckMode before the first session */
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lib.h"
+#include "gdb.h"
+
+#define MAX_REPLIES 512
+
+/* simulated target memory */
+static byte target[0x10000];
+
+/* script of bytes sent by GDB */
+static char *script;
+static size_t script_len, script_size, script_pos;
+
+/* silence of the line: receive timeouts before script byte pos */
+#define MAX_GAPS 8
+static struct {
+  size_t pos;
+  unsigned len;
+  unsigned left;
+} gaps[MAX_GAPS];
+static unsigned gap_count;
+
+/* decoder of bytes sent by the stub */
+static struct {
+  int state;
+  int esc;
+  byte sum;
+  byte csum;
+  char last;
+  char data[0x10000];
+  size_t len;
+} dec;
+static char *replies[MAX_REPLIES];
+static size_t reply_sizes[MAX_REPLIES];
+static unsigned reply_count;
+static unsigned bad_packets;
+
+static size_t bytes_in, bytes_out;
+static unsigned packets_in;
+static int noack, noack_active;
+static jmp_buf resume;
+
+/******************************************************************************/
+
+void *host_memcpy (void *dest, const void *src, unsigned n) {
+  byte *d = dest;
+  const byte *s = src;
+  if ((uintptr_t)dest < sizeof(target))
+    d = &target[(uintptr_t)dest];
+  if ((uintptr_t)src < sizeof(target))
+    s = &target[(uintptr_t)src];
+  memmove (d, s, n);
+  return dest == NULL ? (void *)1 : dest;
+}
+
+static byte *host_ptr (const void *mem) {
+  if ((uintptr_t)mem < sizeof(target))
+    return &target[(uintptr_t)mem];
+  return (byte *)mem;
+}
+
+void *host_get_reg (const void *mem) {
+  const byte *p = host_ptr (mem);
+  return (void *)(uintptr_t)(p[0] | (p[1] << 8));
+}
+
+void host_set_reg (void *mem, const void *val) {
+  byte *p = host_ptr (mem);
+  p[0] = (byte)(uintptr_t)val;
+  p[1] = (byte)((uintptr_t)val >> 8);
+}
+
+#ifdef DBG_FAST_HEX
+/* arguments of the hand written hex codec */
+extern char *_gdb_hex_buf;
+extern byte *_gdb_hex_mem;
+extern unsigned _gdb_hex_len;
+#endif
+
+void host_asm (const char *func) {
+  if (strcmp (func, "_gdb_rest_cpu_state") == 0)
+    longjmp (resume, 1);
+#ifdef DBG_FAST_HEX
+  /* same results as the Z80 loops */
+  if (strcmp (func, "mem2hex_fast") == 0)
+    {
+      for (; _gdb_hex_len != 0; --_gdb_hex_len, ++_gdb_hex_mem)
+	{
+	  *_gdb_hex_buf++ = "0123456789abcdef"[*_gdb_hex_mem >> 4];
+	  *_gdb_hex_buf++ = "0123456789abcdef"[*_gdb_hex_mem & 15];
+	}
+      *_gdb_hex_buf = '\0';
+    }
+  else if (strcmp (func, "hex2mem_fast") == 0)
+    {
+      static const byte values[32] = {
+	0, 10, 11, 12, 13, 14, 15, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9
+      };
+      for (; _gdb_hex_len != 0; --_gdb_hex_len, _gdb_hex_buf += 2)
+	*_gdb_hex_mem++ = values[_gdb_hex_buf[0] & 0x1f] << 4 |
+	  values[_gdb_hex_buf[1] & 0x1f];
+    }
+#endif
+}
+
+/* software breakpoints inserted by the stub */
+static byte sw_breaks[0x10000];
+
+static int host_toggle (int set, void *addr) {
+  sw_breaks[(uintptr_t)addr & 0xffff] = set;
+  return 0;
+}
+
+/* breakpoints are written by the stub itself with DBG_SWBREAK_TABLE */
+static int bp_inserted (unsigned addr) {
+#ifdef DBG_SWBREAK_TABLE
+  return target[addr] == 0xcd;
+#else
+  return sw_breaks[addr];
+#endif
+}
+
+unsigned char gdb_getDebugChar (void) {
+  if (script_pos == script_len)
+    {
+      fprintf (stderr, "bench: stub reads past the end of the script\n");
+      longjmp (resume, 2);
+    }
+  ++bytes_in;
+  return script[script_pos++];
+}
+
+/* receive function of gdb_set_get_char_timeout */
+static int host_get_char_timeout (void) {
+  for (unsigned i = 0; i < gap_count; ++i)
+    if (gaps[i].pos == script_pos && gaps[i].left != 0)
+      {
+	--gaps[i].left;
+	return -1;
+      }
+  return gdb_getDebugChar ();
+}
+
+static int hexval (char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+static void store (char c) {
+  if (dec.len < sizeof(dec.data))
+    dec.data[dec.len++] = c;
+  dec.last = c;
+}
+
+void gdb_putDebugChar (unsigned char ch) {
+  ++bytes_out;
+  switch (dec.state)
+    {
+    case 0: /* between packets */
+      if (ch == '$')
+	{
+	  dec.state = 1;
+	  dec.len = 0;
+	  dec.sum = 0;
+	  dec.esc = 0;
+	}
+      return;
+    case 1: /* packet data */
+      if (ch == '#')
+	{
+	  dec.state = 3;
+	  return;
+	}
+      dec.sum += ch;
+      if (dec.esc)
+	{
+	  store (ch ^ 0x20);
+	  dec.esc = 0;
+	}
+      else if (ch == '}')
+	dec.esc = 1;
+      else if (ch == '*')
+	dec.state = 2;
+      else
+	store (ch);
+      return;
+    case 2: /* run length */
+      dec.sum += ch;
+      for (int n = ch - 29; n > 0; --n)
+	store (dec.last);
+      dec.state = 1;
+      return;
+    case 3:
+      dec.csum = hexval (ch) << 4;
+      dec.state = 4;
+      return;
+    case 4:
+      dec.csum |= hexval (ch);
+      dec.state = 0;
+      if (dec.csum != dec.sum)
+	++bad_packets;
+      if (reply_count < MAX_REPLIES)
+	{
+	  replies[reply_count] = malloc (dec.len + 1);
+	  memcpy (replies[reply_count], dec.data, dec.len);
+	  replies[reply_count][dec.len] = '\0';
+	  reply_sizes[reply_count] = dec.len;
+	  ++reply_count;
+	}
+      return;
+    }
+}
+
+/******************************************************************************/
+
+static void script_put (char c) {
+  if (script_len == script_size)
+    {
+      script_size = script_size ? script_size * 2 : 4096;
+      script = realloc (script, script_size);
+    }
+  script[script_len++] = c;
+}
+
+/* append n receive timeouts */
+static void script_gap (unsigned n) {
+  if (gap_count < MAX_GAPS)
+    {
+      gaps[gap_count].pos = script_len;
+      gaps[gap_count].len = n;
+      ++gap_count;
+    }
+}
+
+/* append packet, binary data is escaped */
+static void packet (const char *data, size_t len) {
+  byte sum = 0;
+  script_put ('$');
+  for (size_t i = 0; i < len; ++i)
+    {
+      char c = data[i];
+      if (c == '$' || c == '#' || c == '}' || c == '*')
+	{
+	  script_put ('}');
+	  sum += '}';
+	  c ^= 0x20;
+	}
+      script_put (c);
+      sum += c;
+    }
+  script_put ('#');
+  script_put ("0123456789abcdef"[sum >> 4]);
+  script_put ("0123456789abcdef"[sum & 15]);
+  ++packets_in;
+  /* acknowledge reply */
+  if (!noack_active)
+    script_put ('+');
+}
+
+static void command (const char *fmt, ...) __attribute__((format (printf, 1, 2)));
+static void command (const char *fmt, ...) {
+  char buf[256];
+  va_list ap;
+  va_start (ap, fmt);
+  vsnprintf (buf, sizeof(buf), fmt, ap);
+  va_end (ap);
+  packet (buf, strlen (buf));
+}
+
+/* resume execution, there is no reply to acknowledge */
+static void resume_command (const char *cmd) {
+  packet (cmd, strlen (cmd));
+  if (!noack_active)
+    --script_len;
+}
+
+static void session_begin (void) {
+  script_len = script_pos = 0;
+  gap_count = 0;
+  packets_in = 0;
+  /* acknowledge stop reply */
+  if (!noack_active)
+    script_put ('+');
+  if (noack && !noack_active)
+    {
+      command ("QStartNoAckMode");
+      noack_active = 1;
+    }
+}
+
+static void session_free (void) {
+  for (unsigned i = 0; i < reply_count; ++i)
+    free (replies[i]);
+  reply_count = 0;
+}
+
+/* address of the software breakpoint hit on the stub entry */
+static unsigned entry_pc = 0x8100;
+/* enter through _gdb_live_main as gdb_int does */
+static int live_entry;
+
+/* enter the stub as if software breakpoint at entry_pc is hit and replay
+   the script, it must end with resume command */
+static int session_run (void) {
+  byte *sp = &target[0xfff0];
+  sp[0] = (entry_pc + 3) & 0xff;
+  sp[1] = (entry_pc + 3) >> 8;
+  host_set_reg (&_gdb_state[R_SP], (void *)(uintptr_t)0xfff0);
+  script_pos = 0;
+  for (unsigned i = 0; i < gap_count; ++i)
+    gaps[i].left = gaps[i].len;
+  dec.state = 0;
+  session_free ();
+  if (setjmp (resume) != 0)
+    ;
+#ifdef DBG_LIVE
+  else if (live_entry)
+    _gdb_live_main (DBG_INT_EX, 0);
+#endif
+  else
+    _gdb_stub_main (EX_SWBREAK, -3);
+  if (script_pos != script_len)
+    {
+      fprintf (stderr, "bench: stub resumed before the end of the script\n");
+      return 1;
+    }
+  return 0;
+}
+
+/******************************************************************************/
+
+/* sizes GDB would use for the reported packet size */
+static unsigned packet_size;
+#ifdef DBG_RUNTIME_BUFFER
+/* placed by the application, make host HOST_CFLAGS="-DDBG_RUNTIME_BUFFER" */
+static char packet_buffer[2048];
+#endif
+
+static void build_stop (void) {
+  session_begin ();
+  command ("?");
+  resume_command ("c");
+}
+
+static int check_stop (void) {
+  char pc[16];
+  const char *r = replies[reply_count - 1];
+  unsigned n = 0;
+  if (reply_count < 2 || r[0] != 'T')
+    return 1;
+  /* registers are expedited in target byte order, other fields such as
+     "swbreak:" give the reason */
+  for (r += 3; r != NULL && *r != '\0'; r = strchr (r, ';'), r = r ? r + 1 : r)
+    if (hexval (r[0]) >= 0 && hexval (r[1]) >= 0 && r[2] == ':')
+      ++n;
+  snprintf (pc, sizeof(pc), "%02x:%02x%02x;", R_PC / REG_SIZE,
+	    entry_pc & 0xff, entry_pc >> 8);
+  return n != (unsigned)__builtin_popcount (DBG_EXPEDITE) ||
+    ((DBG_EXPEDITE >> (R_PC / REG_SIZE) & 1) &&
+     strstr (replies[reply_count - 1], pc) == NULL);
+}
+
+static void build_reg (void) {
+  session_begin ();
+  command ("p%x", R_PC / REG_SIZE);
+  command ("P%x=3412", R_HL / REG_SIZE);
+  command ("p%x", R_HL / REG_SIZE);
+  command ("p%x", NUMREGBYTES / REG_SIZE);
+  resume_command ("c");
+}
+
+static int check_reg (void) {
+  char pc[16];
+  snprintf (pc, sizeof(pc), "%02x%02x", entry_pc & 0xff, entry_pc >> 8);
+  return reply_count != 5 || strcmp (replies[1], pc) != 0 ||
+    strcmp (replies[2], "OK") != 0 || strcmp (replies[3], "3412") != 0 ||
+    replies[4][0] != 'E' || _gdb_state[R_HL] != 0x34 ||
+    _gdb_state[R_HL + 1] != 0x12;
+}
+
+static void build_handshake (void) {
+  session_begin ();
+  /* qSupported starts new connection with acknowledgements */
+  noack_active = 0;
+  command ("qSupported:multiprocess+;swbreak+;hwbreak+;qRelocInsn+;fork-events+");
+  if (noack)
+    {
+      command ("QStartNoAckMode");
+      noack_active = 1;
+    }
+  /* GDB asks for as much as fits its packet */
+  command ("qXfer:features:read:target.xml:0,%x", packet_size - 5);
+  command ("qAttached");
+  command ("?");
+  command ("g");
+  resume_command ("c");
+}
+
+static int check_handshake (void) {
+  const char *p;
+  if (reply_count < 2 || (p = strstr (replies[1], "PacketSize=")) == NULL)
+    return 1;
+  /* target description is read at once */
+  if (strncmp (replies[reply_count - 4], "l<target", 8) != 0)
+    return 1;
+  packet_size = strtoul (p + 11, NULL, 16);
+  return 0;
+}
+
+static void build_g (void) {
+  session_begin ();
+  for (int i = 0; i < 16; ++i)
+    command ("g");
+  resume_command ("c");
+}
+
+static int check_g (void) {
+  for (unsigned i = 1; i < reply_count; ++i)
+    if (reply_sizes[i] != NUMREGBYTES * 2)
+      return 1;
+  return reply_count != 17;
+}
+
+#define DUMP_ADDR 0x8000
+#define DUMP_SIZE 0x1000
+
+static void build_m (void) {
+  unsigned chunk = packet_size / 2;
+  session_begin ();
+  for (unsigned a = 0; a < DUMP_SIZE; a += chunk)
+    command ("m%x,%x", DUMP_ADDR + a, a + chunk > DUMP_SIZE ? DUMP_SIZE - a : chunk);
+  resume_command ("c");
+}
+
+static int check_m (void) {
+  unsigned a = DUMP_ADDR;
+  for (unsigned i = 1; i < reply_count; ++i)
+    for (size_t j = 0; j + 1 < reply_sizes[i]; j += 2, ++a)
+      if (hexval (replies[i][j]) << 4 != (target[a] & 0xf0) ||
+	  hexval (replies[i][j + 1]) != (target[a] & 0x0f))
+	return 1;
+  return a != DUMP_ADDR + DUMP_SIZE;
+}
+
+static void build_x (void) {
+  unsigned chunk = packet_size - 1;
+  session_begin ();
+  for (unsigned a = 0; a < DUMP_SIZE; a += chunk)
+    command ("x%x,%x", DUMP_ADDR + a, a + chunk > DUMP_SIZE ? DUMP_SIZE - a : chunk);
+  resume_command ("c");
+}
+
+static int check_x (void) {
+  unsigned a = DUMP_ADDR;
+  for (unsigned i = 1; i < reply_count; ++i)
+    {
+      if (replies[i][0] != 'b')
+	return 1;
+      if (memcmp (&replies[i][1], &target[a], reply_sizes[i] - 1) != 0)
+	return 1;
+      a += reply_sizes[i] - 1;
+    }
+  return a != DUMP_ADDR + DUMP_SIZE;
+}
+
+#define LOAD_ADDR 0x9000
+#define LOAD_SIZE 0x2000
+static byte image[LOAD_SIZE];
+
+static void build_X (void) {
+  char buf[0x10000];
+  unsigned chunk = packet_size - 16;
+  session_begin ();
+  for (unsigned a = 0; a < LOAD_SIZE; a += chunk)
+    {
+      unsigned len = a + chunk > LOAD_SIZE ? LOAD_SIZE - a : chunk;
+      int n = sprintf (buf, "X%x,%x:", LOAD_ADDR + a, len);
+      memcpy (&buf[n], &image[a], len);
+      packet (buf, n + len);
+    }
+  resume_command ("c");
+}
+
+static int check_X (void) {
+  for (unsigned i = 1; i < reply_count; ++i)
+    if (strcmp (replies[i], "OK") != 0)
+      return 1;
+  return memcmp (&target[LOAD_ADDR], image, LOAD_SIZE) != 0;
+}
+
+#ifdef DBG_FLASH
+/* flash at FLASH_ADDR loaded with vFlashWrite packets of odd size */
+#define FLASH_ADDR 0xd000
+#define FLASH_SIZE 0x800
+#define FLASH_CHUNK 100
+
+static unsigned flash_erased;
+static byte flash_programmed[FLASH_SIZE / DBG_FLASH];
+
+static int host_flash_erase (void *addr, unsigned len) {
+  memset (&target[(uintptr_t)addr & 0xffff], 0xff, len);
+  flash_erased += len;
+  return 0;
+}
+
+/* programming only clears bits, as NOR flash does */
+static int host_flash_program (void *addr, const void *data, unsigned len) {
+  const unsigned a = (uintptr_t)addr & 0xffff;
+  for (unsigned i = 0; i < len; ++i)
+    target[a + i] &= ((const byte *)data)[i];
+  ++flash_programmed[(a - FLASH_ADDR) / DBG_FLASH];
+  return 0;
+}
+
+static void build_flash (void) {
+  char buf[0x10000];
+  memset (flash_programmed, 0, sizeof(flash_programmed));
+  flash_erased = 0;
+  session_begin ();
+  command ("vFlashErase:%x,%x", FLASH_ADDR, FLASH_SIZE);
+  for (unsigned a = 0; a < FLASH_SIZE; a += FLASH_CHUNK)
+    {
+      unsigned len = a + FLASH_CHUNK > FLASH_SIZE ? FLASH_SIZE - a : FLASH_CHUNK;
+      int n = sprintf (buf, "vFlashWrite:%x:", FLASH_ADDR + a);
+      if (a == FLASH_CHUNK)
+	{
+	  /* damaged on the line across two blocks, GDB sends it again */
+	  for (unsigned i = 0; i < len; ++i)
+	    buf[n + i] = ~image[a + i];
+	  packet (buf, n + len);
+	  --packets_in;
+	  if (!noack_active)
+	    --script_len; /* there is no reply to acknowledge */
+	  script[script_len - 1] ^= 1; /* wrong checksum */
+	}
+      memcpy (&buf[n], &image[a], len);
+      packet (buf, n + len);
+    }
+  command ("vFlashDone");
+  resume_command ("c");
+}
+
+/* every block is programmed once */
+static int check_flash (void) {
+  for (unsigned i = 1; i < reply_count; ++i)
+    if (strcmp (replies[i], "OK") != 0)
+      return 1;
+  for (unsigned i = 0; i < sizeof(flash_programmed); ++i)
+    if (flash_programmed[i] != 1)
+      return 1;
+  return flash_erased != FLASH_SIZE ||
+    memcmp (&target[FLASH_ADDR], image, FLASH_SIZE) != 0;
+}
+#endif /* DBG_FLASH */
+
+/* program like data: copies of a few random fragments */
+#define LZ_ADDR 0x1000
+static byte lz_image[LOAD_SIZE];
+
+static byte *lz4_put_len (byte *d, size_t len) {
+  for (; len >= 255; len -= 255)
+    *d++ = 255;
+  *d++ = (byte)len;
+  return d;
+}
+
+static byte *lz4_put_seq (byte *d, const byte *lit, size_t nlit,
+			  size_t offset, size_t mlen) {
+  byte *token = d++;
+  *token = (nlit < 15 ? nlit : 15) << 4;
+  if (nlit >= 15)
+    d = lz4_put_len (d, nlit - 15);
+  memcpy (d, lit, nlit);
+  d += nlit;
+  if (mlen == 0)
+    return d;
+  *d++ = offset & 0xff;
+  *d++ = offset >> 8;
+  mlen -= 4;
+  *token |= mlen < 15 ? mlen : 15;
+  if (mlen >= 15)
+    d = lz4_put_len (d, mlen - 15);
+  return d;
+}
+
+/* greedy LZ4 block compressor, as tools/lz4load.py does it */
+static size_t lz4_compress (byte *dst, const byte *src, size_t n) {
+  static long head[4096];
+  size_t i = 0, anchor = 0;
+  byte *d = dst;
+  for (size_t h = 0; h < 4096; ++h)
+    head[h] = -1;
+  while (i + 12 <= n)
+    {
+      const unsigned h = ((src[i] | src[i + 1] << 8 | src[i + 2] << 16 |
+			   (unsigned)src[i + 3] << 24) * 2654435761u) >> 20;
+      const long cand = head[h];
+      head[h] = i;
+      if (cand < 0 || i - cand > 0xffff || memcmp (&src[cand], &src[i], 4) != 0)
+	{
+	  ++i;
+	  continue;
+	}
+      size_t len = 4;
+      while (i + len < n - 5 && src[cand + len] == src[i + len])
+	++len;
+      d = lz4_put_seq (d, &src[anchor], i - anchor, i - cand, len);
+      i += len;
+      anchor = i;
+    }
+  return lz4_put_seq (d, &src[anchor], n - anchor, 0, 0) - dst;
+}
+
+/* size of the packet buffer, which is less than the reported packet size
+   with DBG_STREAM_WRITE */
+#ifdef DBG_RUNTIME_BUFFER
+#define LZ_PACKET_SIZE (sizeof(packet_buffer) - 1)
+#else
+#define LZ_PACKET_SIZE DBG_PACKET_SIZE
+#endif
+
+static void build_lz4 (void) {
+  char buf[0x10000];
+  memset (&target[LZ_ADDR], 0, LOAD_SIZE);
+  for (unsigned i = 0; i < LOAD_SIZE; ++i)
+    lz_image[i] = (i & 31) < 6 ? image[i] : image[(i & 31) + (i >> 7 & 7) * 32];
+  session_begin ();
+  command ("qLZ4");
+  for (unsigned a = 0; a < LOAD_SIZE;)
+    {
+      /* the block must fit to the packet buffer */
+      unsigned len = LOAD_SIZE - a;
+      int n;
+      size_t c;
+      for (;; len /= 2)
+	{
+	  n = sprintf (buf, "QLZ4:%x,%x:", LZ_ADDR + a, len);
+	  c = lz4_compress ((byte *)&buf[n], &lz_image[a], len);
+	  if (n + c < LZ_PACKET_SIZE)
+	    break;
+	}
+      packet (buf, n + c);
+      a += len;
+    }
+  resume_command ("c");
+}
+
+static int check_lz4 (void) {
+  if (reply_count < 4 || strtoul (replies[1], NULL, 16) != LZ_PACKET_SIZE)
+    return 1;
+  for (unsigned i = 2; i < reply_count; ++i)
+    if (strcmp (replies[i], "OK") != 0)
+      return 1;
+  return memcmp (&target[LZ_ADDR], lz_image, LOAD_SIZE) != 0;
+}
+
+static void build_M (void) {
+  char buf[0x10000];
+  unsigned chunk = (packet_size - 16) / 2;
+  session_begin ();
+  for (unsigned a = 0; a < LOAD_SIZE; a += chunk)
+    {
+      unsigned len = a + chunk > LOAD_SIZE ? LOAD_SIZE - a : chunk;
+      int n = sprintf (buf, "M%x,%x:", LOAD_ADDR + a, len);
+      for (unsigned i = 0; i < len; ++i)
+	n += sprintf (&buf[n], "%02x", image[a + i]);
+      packet (buf, n);
+    }
+  resume_command ("c");
+}
+
+/* verify of the loaded image as done by compare-sections */
+static void build_crc (void) {
+  session_begin ();
+  command ("qCRC:%x,%x", LOAD_ADDR, LOAD_SIZE);
+  resume_command ("c");
+}
+
+static int check_crc (void) {
+  unsigned long crc = 0xffffffff;
+  for (unsigned i = 0; i < LOAD_SIZE; ++i)
+    {
+      crc ^= (unsigned long)image[i] << 24;
+      for (int b = 0; b < 8; ++b)
+	crc = (crc & 0x80000000 ? (crc << 1) ^ 0x04c11db7 : crc << 1) & 0xffffffff;
+    }
+  return reply_count != 2 || replies[1][0] != 'C' ||
+    strtoul (&replies[1][1], NULL, 16) != crc;
+}
+
+/* find command, the pattern is taken from the end of the loaded image */
+#define SEARCH_OFFSET 0x1f00
+#define SEARCH_SIZE 6
+
+static void build_search (void) {
+  char buf[64];
+  int n = sprintf (buf, "qSearch:memory:%x;%x;", LOAD_ADDR, LOAD_SIZE);
+  memcpy (&buf[n], &image[SEARCH_OFFSET], SEARCH_SIZE);
+  session_begin ();
+  packet (buf, n + SEARCH_SIZE);
+  resume_command ("c");
+}
+
+static int check_search (void) {
+  unsigned a = 0;
+  char expected[16];
+  while (memcmp (&image[a], &image[SEARCH_OFFSET], SEARCH_SIZE) != 0)
+    ++a;
+  sprintf (expected, "1,%04x", LOAD_ADDR + a);
+  return reply_count != 2 || strcmp (replies[1], expected) != 0;
+}
+
+/* software stepper: instruction at 0xc000, flags, B and expected
+   address of the temporary breakpoint */
+#define STEP_ADDR 0xc000
+static const struct step_case {
+  byte code[4];
+  byte f, b;
+  unsigned next;
+} step_cases[] = {
+  { { 0x00 }, 0, 0, 0xc001 },			/* nop */
+  { { 0x21, 0x34, 0x12 }, 0, 0, 0xc003 },	/* ld hl,0x1234 */
+  { { 0x18, 0x05 }, 0, 0, 0xc007 },		/* jr $+7 */
+  { { 0x20, 0xfe }, 0x40, 0, 0xc002 },		/* jr nz,$ with Z set */
+  { { 0x28, 0xfe }, 0x40, 0, 0xc000 },		/* jr z,$ with Z set */
+  { { 0x10, 0x10 }, 0, 1, 0xc002 },		/* djnz with B=1 */
+  { { 0x10, 0xf0 }, 0, 2, 0xbff2 },		/* djnz with B=2 */
+  { { 0xc3, 0x23, 0xc1 }, 0, 0, 0xc123 },	/* jp 0xc123 */
+  { { 0xea, 0x23, 0xc1 }, 0x04, 0, 0xc123 },	/* jp pe,0xc123 */
+  { { 0xf2, 0x23, 0xc1 }, 0x80, 0, 0xc003 },	/* jp p,0xc123 with S set */
+  { { 0xcd, 0x00, 0xc2 }, 0, 0, 0xc200 },	/* call 0xc200 */
+  { { 0xdc, 0x00, 0xc2 }, 0, 0, 0xc003 },	/* call c,0xc200 with C clear */
+  { { 0xff }, 0, 0, 0x0038 },			/* rst 0x38 */
+  { { 0xc9 }, 0, 0, 0xc456 },			/* ret */
+  { { 0xd8 }, 0x01, 0, 0xc456 },		/* ret c with C set */
+  { { 0xed, 0x4d }, 0, 0, 0xc456 },		/* reti */
+  { { 0xed, 0xb0 }, 0, 0, 0xc002 },		/* ldir */
+  { { 0xed, 0x53, 0x00, 0x90 }, 0, 0, 0xc004 },	/* ld (0x9000),de */
+  { { 0xdd, 0x36, 0x05, 0x07 }, 0, 0, 0xc004 },	/* ld (ix+5),7 */
+  { { 0xfd, 0xcb, 0x02, 0x46 }, 0, 0, 0xc004 },	/* bit 0,(iy+2) */
+  { { 0xdd, 0x7e, 0x01 }, 0, 0, 0xc003 },	/* ld a,(ix+1) */
+  { { 0xdd, 0x21, 0x00, 0x80 }, 0, 0, 0xc004 },	/* ld ix,0x8000 */
+  { { 0xdd, 0xe9 }, 0, 0, 0xd000 },		/* jp (ix) with IX=0xd000 */
+  { { 0xe9 }, 0, 0, 0xd100 },			/* jp (hl) with HL=0xd100 */
+  { { 0xcb, 0x47 }, 0, 0, 0xc002 },		/* bit 0,a */
+};
+
+static unsigned step_case;
+
+static void build_step (void) {
+  const struct step_case *sc = &step_cases[step_case];
+  memcpy (&target[STEP_ADDR], sc->code, sizeof(sc->code));
+  /* return address of ret is on top of the stack after the stub entry */
+  target[0xfff2] = 0x56;
+  target[0xfff3] = 0xc4;
+  _gdb_state[R_AF] = sc->f;
+  _gdb_state[R_BC + 1] = sc->b;
+  _gdb_state[R_HL] = 0x00;
+  _gdb_state[R_HL + 1] = 0xd1;
+  _gdb_state[R_IX] = 0x00;
+  _gdb_state[R_IX + 1] = 0xd0;
+  session_begin ();
+  resume_command ("sc000");
+}
+
+static int check_step_case (void) {
+  return target[step_cases[step_case].next] != 0xcd;
+}
+
+static int check_step (void) {
+  size_t in = bytes_in, out = bytes_out;
+  /* the first case has been run by the caller, breakpoint of a step is
+     removed when the stub is entered next time */
+  if (check_step_case ())
+    return 1;
+  for (step_case = 1; step_case < sizeof(step_cases) / sizeof(step_cases[0]); ++step_case)
+    {
+      build_step ();
+      if (session_run () || check_step_case ())
+	{
+	  fprintf (stderr, "bench: step case %u failed\n", step_case);
+	  return 1;
+	}
+    }
+  step_case = 0;
+  build_step ();
+  bytes_in = in;
+  bytes_out = out;
+  return 0;
+}
+
+/* range stepping over four nops, the stub must step silently until PC
+   leaves the range */
+static void build_range (void) {
+  memset (&target[STEP_ADDR], 0, 4);
+  entry_pc = STEP_ADDR;
+  session_begin ();
+  command ("vCont?");
+  resume_command ("vCont;rc000,c004");
+}
+
+static int check_range (void) {
+  size_t in = bytes_in, out = bytes_out;
+  int ret = 0;
+  if (reply_count != 2 || strcmp (replies[1], "vCont;c;C;s;S;r") != 0)
+    return 1;
+  /* hit of the step breakpoint inside the range resumes at once */
+  script_len = 0;
+  for (entry_pc = STEP_ADDR + 1; entry_pc < STEP_ADDR + 4; ++entry_pc)
+    if (target[entry_pc] != 0xcd || session_run () || reply_count != 0)
+      ret = 1;
+  /* leaving the range is reported as a plain trap */
+  session_begin ();
+  resume_command ("c");
+  if (target[entry_pc] != 0xcd || session_run () ||
+      reply_count != 1 || strncmp (replies[0], "T05", 3) != 0 ||
+      strstr (replies[0], "swbreak") != NULL)
+    ret = 1;
+  build_range ();
+  bytes_in = in;
+  bytes_out = out;
+  return ret;
+}
+
+/* breakpoint at 0xc100 with condition "hl == 500" */
+#define COND_ADDR 0xc100
+
+static void build_cond (void) {
+  target[COND_ADDR] = 0; /* nop */
+  entry_pc = 0x8100;
+  session_begin ();
+  /* reg 3; const16 500; equal; end */
+  command ("Z0,%x,1;X8,2600032301f41327", COND_ADDR);
+  resume_command ("c");
+}
+
+/* enter the stub at pc with HL set, return number of replies */
+static int cond_hit (unsigned pc, unsigned hl) {
+  entry_pc = pc;
+  _gdb_state[R_HL] = hl & 0xff;
+  _gdb_state[R_HL + 1] = hl >> 8;
+  session_begin ();
+  if (hl == 500)
+    resume_command ("c");
+  else
+    script_len = 0;
+  if (session_run ())
+    return -1;
+  return reply_count;
+}
+
+static int check_cond (void) {
+  size_t in = bytes_in, out = bytes_out;
+  int ret = 0;
+  if (reply_count != 2 || strcmp (replies[1], "OK") != 0 || !bp_inserted (COND_ADDR))
+    return 1;
+  /* false condition: breakpoint is removed and stepped over silently */
+  if (cond_hit (COND_ADDR, 499) != 0 || bp_inserted (COND_ADDR) ||
+      target[COND_ADDR + 1] != 0xcd)
+    ret = 1;
+  /* step trap: breakpoint is inserted back and execution continues */
+  if (cond_hit (COND_ADDR + 1, 499) != 0 || !bp_inserted (COND_ADDR))
+    ret = 1;
+  /* true condition stops */
+  if (cond_hit (COND_ADDR, 500) != 1 || strstr (replies[0], "swbreak") == NULL)
+    ret = 1;
+  build_cond ();
+  bytes_in = in;
+  bytes_out = out;
+  return ret;
+}
+
+static void build_Z (void) {
+  session_begin ();
+  for (int i = 0; i < 16; ++i)
+    command ("Z0,%x,1", 0x8100 + i * 7);
+  resume_command ("c");
+}
+
+static void build_z (void) {
+  session_begin ();
+  for (int i = 0; i < 16; ++i)
+    command ("z0,%x,1", 0x8100 + i * 7);
+  resume_command ("c");
+}
+
+static int check_ok (void) {
+  for (unsigned i = 1; i < reply_count; ++i)
+    if (strcmp (replies[i], "OK") != 0)
+      return 1;
+  return 0;
+}
+
+static int check_Z (void) {
+  for (int i = 0; i < 16; ++i)
+    if (!bp_inserted (0x8100 + i * 7))
+      return 1;
+  return check_ok ();
+}
+
+static int check_z (void) {
+  for (int i = 0; i < 16; ++i)
+    if (bp_inserted (0x8100 + i * 7))
+      return 1;
+  return check_ok ();
+}
+
+/* tracepoints need the breakpoint table of the stub */
+#if defined(DBG_TRACE) && defined(DBG_SWBREAK_TABLE)
+/* tracepoint at 0xc200 collecting 16 bytes at 0xa000 and 4 bytes at HL */
+#define TRACE_ADDR 0xc200
+#define TRACE_HITS 3
+
+static void build_trace (void) {
+  target[TRACE_ADDR] = 0; /* nop */
+  session_begin ();
+  command ("QTinit");
+  command ("QTDP:1:%x:E:0:0-", TRACE_ADDR);
+  command ("QTDP:-1:%x:R3fff-", TRACE_ADDR);
+  command ("QTDP:-1:%x:MFFFFFFFF,a000,10-", TRACE_ADDR);
+  command ("QTDP:-1:%x:M3,0,4", TRACE_ADDR);
+  command ("QTStart");
+  resume_command ("c");
+}
+
+static int check_trace (void) {
+  size_t in = bytes_in, out = bytes_out;
+  char expect[64];
+  int ret = 0;
+  if (check_ok () || !bp_inserted (TRACE_ADDR))
+    return 1;
+  for (unsigned i = 0; i < TRACE_HITS; ++i)
+    {
+      target[0xa000] = i;
+      /* frame is collected and the tracepoint is stepped over silently */
+      if (cond_hit (TRACE_ADDR, 0xb000 + i) != 0 || bp_inserted (TRACE_ADDR))
+        ret = 1;
+      if (cond_hit (TRACE_ADDR + 1, 0) != 0 || !bp_inserted (TRACE_ADDR))
+        ret = 1;
+    }
+  entry_pc = 0x8100;
+  session_begin ();
+  command ("qTStatus");
+  command ("QTFrame:1");
+  command ("g");
+  command ("ma000,10");
+  command ("mb001,4");
+  command ("QTFrame:pc:%x", TRACE_ADDR);
+  command ("QTFrame:ffffffff");
+  command ("QTStop");
+  resume_command ("c");
+  if (session_run () || reply_count != 9)
+    ret = 1;
+  else
+    {
+      snprintf (expect, sizeof(expect), "T1;tnotrun:0000;tframes:%04x;tcreated:%04x",
+		TRACE_HITS, TRACE_HITS);
+      if (strncmp (replies[1], expect, strlen (expect)) != 0 ||
+	  strcmp (replies[2], "F0001T0001") != 0 ||
+	  strncmp (replies[3] + R_HL * 2, "01b0", 4) != 0 ||
+	  strncmp (replies[4], "01", 2) != 0 || strlen (replies[5]) != 8 ||
+	  strcmp (replies[6], "F0002T0001") != 0 ||
+	  strcmp (replies[7], "F-1") != 0 || strcmp (replies[8], "OK") != 0 ||
+	  bp_inserted (TRACE_ADDR))
+	ret = 1;
+    }
+  /* z0 keeps the tracepoint at the same address */
+  entry_pc = 0x8100;
+  session_begin ();
+  command ("Z0,%x,3", TRACE_ADDR);
+  command ("QTStart");
+  command ("z0,%x,3", TRACE_ADDR);
+  resume_command ("c");
+  if (session_run () || !bp_inserted (TRACE_ADDR) ||
+      cond_hit (TRACE_ADDR, 0) != 0)
+    ret = 1;
+  /* QTStop keeps the breakpoint of GDB, which stops the program */
+  entry_pc = 0x8100;
+  session_begin ();
+  command ("Z0,%x,3", TRACE_ADDR);
+  command ("QTStop");
+  resume_command ("c");
+  if (session_run () || !bp_inserted (TRACE_ADDR))
+    ret = 1;
+  entry_pc = TRACE_ADDR;
+  session_begin ();
+  command ("z0,%x,3", TRACE_ADDR);
+  resume_command ("c");
+  if (session_run () || replies[0][0] != 'T' || bp_inserted (TRACE_ADDR))
+    ret = 1;
+  entry_pc = 0x8100;
+  build_trace ();
+  bytes_in = in;
+  bytes_out = out;
+  return ret;
+}
+#endif /* DBG_TRACE && DBG_SWBREAK_TABLE */
+
+#ifdef DBG_LIVE
+/* one packet received by the INT handler while the program runs */
+static void build_live (const char *cmd) {
+  script_len = script_pos = 0;
+  gap_count = 0;
+  packets_in = 0;
+  live_entry = 1;
+  if (*cmd == '\003')
+    {
+      /* break: stop reply, then continue */
+      script_put (*cmd);
+      ++packets_in;
+      if (!noack_active)
+	script_put ('+');
+      resume_command ("c");
+    }
+  else
+    command ("%s", cmd);
+}
+
+#define LIVE_BP_ADDR 0xc300
+
+static void build_live_m (void) {
+  build_live ("m8000,40");
+}
+
+static int check_live (void) {
+  size_t in = bytes_in, out = bytes_out;
+  int ret = 0;
+  if (reply_count != 1 || strlen (replies[0]) != 0x80 ||
+      host_get_reg (&_gdb_state[R_PC]) != (void *)(uintptr_t)(entry_pc + 3))
+    ret = 1;
+  for (unsigned a = 0; ret == 0 && a < 0x40; ++a)
+    if (hexval (replies[0][a * 2]) << 4 != (target[DUMP_ADDR + a] & 0xf0))
+      ret = 1;
+  /* G changes registers of the program, it is refused */
+  build_live ("G00");
+  if (session_run () || reply_count != 1 || replies[0][0] != '\0')
+    ret = 1;
+  /* break enters the stub */
+  build_live ("\003");
+  if (session_run () || reply_count != 1 || replies[0][0] != 'T')
+    ret = 1;
+  /* code under a breakpoint is read and left intact */
+  memcpy (&target[LIVE_BP_ADDR], "\x10\x11\x12", 3);
+  live_entry = 0;
+  session_begin ();
+  command ("Z0,%x,3", LIVE_BP_ADDR);
+  resume_command ("c");
+  if (session_run () || !bp_inserted (LIVE_BP_ADDR))
+    ret = 1;
+  build_live ("mc300,3");
+  if (session_run () || reply_count != 1 || strcmp (replies[0], "101112") != 0 ||
+      !bp_inserted (LIVE_BP_ADDR))
+    ret = 1;
+  script_len = script_pos = 0;
+  gap_count = 0;
+  script_put ('\003');
+  if (!noack_active)
+    script_put ('+');
+  command ("z0,%x,3", LIVE_BP_ADDR);
+  resume_command ("c");
+  if (session_run () || reply_count != 2 ||
+      memcmp (&target[LIVE_BP_ADDR], "\x10\x11\x12", 3) != 0)
+    ret = 1;
+  build_live_m ();
+  bytes_in = in;
+  bytes_out = out;
+  return ret;
+}
+#endif /* DBG_LIVE */
+
+#if defined(DBG_PROFILER) || defined(DBG_STATS)
+/* qRcmd with the command in hex, as "monitor" sends it */
+static void monitor (const char *cmd) {
+  char hex[128];
+  for (size_t i = 0; cmd[i] != '\0' && i < sizeof(hex) / 2 - 1; ++i)
+    sprintf (&hex[i * 2], "%02x", (byte)cmd[i]);
+  command ("qRcmd,%s", hex);
+}
+#endif
+
+#ifdef DBG_PROFILER
+static void build_prof (void) {
+  memset (_gdb_prof_hist, 0, sizeof(_gdb_prof_hist));
+  _gdb_prof_hist[0x8100 >> DBG_PROFILER_SHIFT] = 5;
+  _gdb_prof_hist[0xc200 >> DBG_PROFILER_SHIFT] = 0x1234;
+  _gdb_prof_on = 1;
+  session_begin ();
+  monitor ("prof");
+  monitor ("prof stop");
+  resume_command ("c");
+}
+
+static int check_prof (void) {
+  size_t in = bytes_in, out = bytes_out;
+  char text[256] = "";
+  size_t n = 0;
+  unsigned i;
+  int ret = 0;
+  /* console output comes in O packets before OK */
+  for (i = 1; i < reply_count && replies[i][0] == 'O' &&
+	 strcmp (replies[i], "OK") != 0; ++i)
+    for (const char *p = &replies[i][1];
+	 p[0] != '\0' && p[1] != '\0' && n < sizeof(text) - 1; p += 2)
+      text[n++] = hexval (p[0]) << 4 | hexval (p[1]);
+  text[n] = '\0';
+  if (strcmp (text, "prof 08\n8100 0005\nc200 1234\n") != 0 ||
+      reply_count != i + 2 || strcmp (replies[i], "OK") != 0 ||
+      strcmp (replies[i + 1], "OK") != 0 || _gdb_prof_on)
+    ret = 1;
+  session_begin ();
+  monitor ("prof start");
+  monitor ("prof bogus");
+  monitor ("bogus");
+  resume_command ("c");
+  if (session_run () || reply_count != 4 || strcmp (replies[1], "OK") != 0 ||
+      replies[2][0] != 'E' || replies[3][0] != 'E' || !_gdb_prof_on ||
+      _gdb_prof_hist[0x8100 >> DBG_PROFILER_SHIFT] != 0)
+    ret = 1;
+  build_prof ();
+  bytes_in = in;
+  bytes_out = out;
+  return ret;
+}
+#endif /* DBG_PROFILER */
+
+#ifdef DBG_STATS
+/* timer of gdb_set_ticks, advances on every read */
+static word ticks;
+
+static word host_ticks (void) {
+  return ticks += 10;
+}
+
+static void build_stats (void) {
+  session_begin ();
+  monitor ("stats reset");
+  command ("g");
+  /* rejected for wrong checksum, GDB would send it again */
+  for (const char *p = "$g#00"; *p != '\0'; ++p)
+    script_put (*p);
+  command ("g");
+  monitor ("stats");
+  resume_command ("c");
+}
+
+/* console output of the last monitor command */
+static void console_text (char *text, size_t size) {
+  size_t n = 0;
+  for (unsigned i = 1; i < reply_count; ++i)
+    if (replies[i][0] == 'O' && strcmp (replies[i], "OK") != 0)
+      for (const char *p = &replies[i][1];
+	   p[0] != '\0' && p[1] != '\0' && n < size - 1; p += 2)
+	text[n++] = hexval (p[0]) << 4 | hexval (p[1]);
+  text[n] = '\0';
+}
+
+static int check_stats (void) {
+  static const char *const expect[] = {
+    " packets in 3 out 3 ", " naks 1 bad checksums 1 retransmits 0",
+    " ticks 0", " g 2 q 1\n"
+  };
+  char text[256];
+  console_text (text, sizeof(text));
+  for (size_t i = 0; i < sizeof(expect) / sizeof(expect[0]); ++i)
+    if (strstr (text, expect[i]) == NULL)
+      return 1;
+  return strcmp (replies[reply_count - 1], "OK") != 0;
+}
+#endif /* DBG_STATS */
+
+static void build_timeouts (void) {
+  session_begin ();
+  /* the line goes silent in the middle of a packet, it is dropped */
+  for (const char *p = "$m8000,1"; *p != '\0'; ++p)
+    script_put (*p);
+  script_gap (DBG_TIMEOUT);
+  command ("g");
+  if (!noack_active)
+    {
+      /* the acknowledgement is lost once, the reply is sent again */
+      --script_len;
+      script_gap (DBG_TIMEOUT);
+      script_put ('+');
+      /* never acknowledged, the stub gives up after DBG_RETRIES */
+      command ("m8000,1");
+      --script_len;
+      script_gap ((DBG_RETRIES + 1) * DBG_TIMEOUT);
+    }
+  command ("g");
+  resume_command ("c");
+}
+
+static int check_timeouts (void) {
+  size_t in = bytes_in, out = bytes_out;
+  unsigned i, n = noack_active ? 3 : 3 + 1 + DBG_RETRIES + 1;
+  int ret = 0;
+  if (reply_count != n)
+    return 1;
+  for (i = 1; i < n; ++i)
+    if (reply_sizes[i] != (i == 1 || i == 2 || i == n - 1 ?
+			   NUMREGBYTES * 2 : 2))
+      return 1;
+  if (noack_active)
+    return 0;
+  /* OK to QStartNoAckMode is never acknowledged, GDB has switched to
+     no-ack mode anyway, so the stub does the same */
+  session_begin ();
+  command ("QStartNoAckMode");
+  --script_len;
+  script_gap ((DBG_RETRIES + 1) * DBG_TIMEOUT);
+  noack_active = 1;
+  command ("g");
+  noack_active = 0;
+  /* new connection starts with acknowledgements */
+  command ("qSupported");
+  resume_command ("c");
+  n = 1 + DBG_RETRIES + 1 + 2;
+  if (session_run () || reply_count != n ||
+      reply_sizes[n - 2] != NUMREGBYTES * 2)
+    ret = 1;
+  build_timeouts ();
+  bytes_in = in;
+  bytes_out = out;
+  return ret;
+}
+
+static const struct scenario {
+  const char *name;
+  void (*build)(void);
+  int (*check)(void);
+} scenarios[] = {
+  { "stop reply", build_stop, check_stop },
+  { "handshake", build_handshake, check_handshake },
+  { "p/P", build_reg, check_reg },
+  { "g x16", build_g, check_g },
+  { "m 4 KiB", build_m, check_m },
+  { "x 4 KiB", build_x, check_x },
+  { "M 8 KiB load", build_M, check_X },
+  { "X 8 KiB load", build_X, check_X },
+#ifdef DBG_FLASH
+  { "vFlash 2 KiB", build_flash, check_flash },
+#endif
+  { "QLZ4 8 KiB load", build_lz4, check_lz4 },
+  { "qCRC 8 KiB", build_crc, check_crc },
+  { "qSearch 8 KiB", build_search, check_search },
+  { "s", build_step, check_step },
+  { "vCont;r", build_range, check_range },
+  { "Z0 cond", build_cond, check_cond },
+#if defined(DBG_TRACE) && defined(DBG_SWBREAK_TABLE)
+  { "QTDP trace", build_trace, check_trace },
+#endif
+#ifdef DBG_LIVE
+  { "m live", build_live_m, check_live },
+#endif
+#ifdef DBG_PROFILER
+  { "monitor prof", build_prof, check_prof },
+#endif
+#ifdef DBG_STATS
+  { "monitor stats", build_stats, check_stats },
+#endif
+  { "timeouts", build_timeouts, check_timeouts },
+  { "Z0 x16", build_Z, check_Z },
+  { "z0 x16", build_z, check_z },
+};
+
+static double now (void) {
+  struct timespec ts;
+  clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int main (int argc, char **argv) {
+  unsigned iterations = 200;
+  int opt, failed = 0;
+  while ((opt = getopt (argc, argv, "an:")) != -1)
+    switch (opt)
+      {
+      case 'a':
+	noack = 1;
+	break;
+      case 'n':
+	iterations = strtoul (optarg, NULL, 0);
+	break;
+      default:
+	fprintf (stderr, "usage: %s [-a] [-n iterations]\n", argv[0]);
+	return 2;
+      }
+  if (iterations == 0)
+    iterations = 1;
+
+  gdb_set_swbreak_toggle (host_toggle);
+#ifdef DBG_FLASH
+  gdb_set_flash (host_flash_erase, host_flash_program);
+#endif
+#ifdef DBG_STATS
+  gdb_set_ticks (host_ticks);
+#endif
+  gdb_set_get_char_timeout (host_get_char_timeout);
+#ifdef DBG_RUNTIME_BUFFER
+  gdb_set_buffer (packet_buffer, sizeof(packet_buffer));
+#endif
+#ifdef DBG_TRANSPORT
+  gdb_set_get_char (gdb_getDebugChar);
+  gdb_set_put_char (gdb_putDebugChar);
+#endif
+  /* sparse RAM: program like data followed by zero filled area */
+  srand (1);
+  for (unsigned i = 0; i < DUMP_SIZE / 2; ++i)
+    target[DUMP_ADDR + i] = (i & 3) ? rand () : 0;
+  for (unsigned i = 0; i < LOAD_SIZE; ++i)
+    image[i] = (i % 5) ? rand () : 0;
+#ifdef DBG_RUNTIME_BUFFER
+  packet_size = sizeof(packet_buffer) - 1;
+#else
+  packet_size = DBG_PACKET_SIZE;
+#endif
+
+  printf ("%-14s %8s %10s %10s %12s %12s\n", "session", "packets",
+	  "to stub", "from stub", "us/session", "us/packet");
+  for (size_t s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); ++s)
+    {
+      const struct scenario *sc = &scenarios[s];
+      double t;
+      size_t in, out;
+      unsigned i;
+      entry_pc = 0x8100;
+      live_entry = 0;
+      sc->build ();
+      bytes_in = bytes_out = bad_packets = 0;
+      if (session_run () || bad_packets || sc->check ())
+	{
+	  printf ("%-14s FAILED (%u bad packets)\n", sc->name, bad_packets);
+	  failed = 1;
+	  continue;
+	}
+      in = bytes_in;
+      out = bytes_out;
+      t = now ();
+      for (i = 0; i < iterations; ++i)
+	if (session_run ())
+	  break;
+      if (i != iterations)
+	{
+	  printf ("%-14s FAILED (timed run %u)\n", sc->name, i + 1);
+	  failed = 1;
+	  continue;
+	}
+      t = (now () - t) / iterations;
+      printf ("%-14s %8u %10zu %10zu %12.2f %12.2f\n", sc->name, packets_in,
+	      in, out, t, t / packets_in);
+    }
+  session_free ();
+  free (script);
+  return failed;
+}
@@ -0,0 +1,75 @@
+/* Host build configuration of the stub.
+
+   Copyright (C) 2022 Empathic Qubit.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* This file is force-included into src/lib.c and src/gdb.c when they are
+   compiled for the host by "make host". Inline assembler blocks are replaced
+   by DBG_HOST_ASM(function name) while copying the sources, target memory
+   is simulated by a 64 KiB array accessed through DBG_MEMCPY.
+   Additional options may be given in HOST_CFLAGS, for example
+     make host HOST_CFLAGS="-O2 -DDBG_STREAM -DDBG_STREAM_WRITE" */
+
+#ifndef __GDB_HOST_CONFIG_H__
+#define __GDB_HOST_CONFIG_H__
+
+#include <stdint.h>
+
+#define __naked
+#define __LIB__
+#define FASTCALL
+#define export(returntype, signature) returntype signature;
+
+void host_asm (const char *func);
+#define DBG_HOST_ASM(func) host_asm (func)
+
+/* target addresses are below 0x10000, everything else is host memory */
+void *host_memcpy (void *dest, const void *src, unsigned n);
+void *host_get_reg (const void *mem);
+void host_set_reg (void *mem, const void *val);
+#define get_reg_value(mem) host_get_reg (mem)
+#define set_reg_value(mem,val) host_set_reg ((mem), (val))
+
+#define DBG_CONFIGURED
+#define DBG_SWBREAK _gdb_toggle_swbreak
+#define DBG_HWBREAK _gdb_toggle_hwbreak
+#ifndef HOST_NO_SWBREAK_TABLE
+#define DBG_SWBREAK_TABLE 32
+#endif
+#define DBG_SOFTSTEP
+#define DBG_COND
+#define DBG_TRACE
+#define DBG_LIVE
+#define DBG_PROFILER
+#define DBG_FLASH 128
+#define DBG_LZ4
+#define DBG_STATS
+#define DBG_TIMEOUT 3
+#define DBG_MEMCPY host_memcpy
+#ifndef DBG_PACKET_SIZE
+#define DBG_PACKET_SIZE 800
+#endif
+#ifndef HOST_NO_RLE
+#define DBG_RLE
+#endif
+#define DBG_PRINT
+#define DBG_FEATURE_STR "<target version=\"1.0\">"\
+"<architecture>z80</architecture>"\
+"</target>"
+#define DBG_NMI_EX EX_HWBREAK
+#define DBG_INT_EX EX_SIGINT
+#define DBG_ENTER if(_gdb_enter_func) { _gdb_enter_func(); };
+
+#endif /* __GDB_HOST_CONFIG_H__ */
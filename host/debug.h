@@ -0,0 +1,2 @@
+/* Application configuration header included by src/lib.c. The host build
+   is configured by host/config.h instead. */
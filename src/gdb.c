@@ -78,13 +78,59 @@ void gdb_int(void) __naked {
 	push	hl
 	ld	hl, DBG_INT_EX
 	push	hl
+#ifdef DBG_LIVE
+	ld	hl, __gdb_live_main
+#else
 	ld	hl, __gdb_stub_main
+#endif
+	push	hl
 	push	hl
+	ei
+	reti
+  __endasm;
+}
+
+#ifdef DBG_PROFILER
+/* count the interrupted PC in _gdb_prof_hist[PC >> DBG_PROFILER_SHIFT],
+   counters stop at 0xffff */
+void gdb_sample(void) __naked {
+  __asm
+	ex	(sp), hl
+	push	af
+	ld	a, (__gdb_prof_on)
+	or	a, a
+	jr	z, gdb_sample_end
+	push	bc
 	push	hl
+#if DBG_PROFILER_SHIFT > 1
+	ld	b, DBG_PROFILER_SHIFT - 1
+gdb_sample_shift:
+	srl	h
+	rr	l
+	djnz	gdb_sample_shift
+#endif
+	res	0, l
+	ld	bc, __gdb_prof_hist
+	add	hl, bc
+	inc	(hl)
+	jr	nz, gdb_sample_done
+	inc	hl
+	inc	(hl)
+	jr	nz, gdb_sample_done
+	dec	(hl)
+	dec	hl
+	dec	(hl)
+gdb_sample_done:
+	pop	hl
+	pop	bc
+gdb_sample_end:
+	pop	af
+	ex	(sp), hl
 	ei
 	reti
   __endasm;
 }
+#endif /* DBG_PROFILER */
 
 #ifndef __SDCC_gbz80
 void gdb_nmi(void) __naked {
@@ -131,6 +177,59 @@ _break_handler = _gdb_swbreak
 }
 #endif /* DBG_SWBREAK */
 
+#ifdef DBG_TRANSPORT
+void gdb_set_get_char(unsigned char (*getter)(void)) {
+    _gdb_get_char = getter;
+}
+
+void gdb_set_put_char(void (*putter)(unsigned char)) {
+    _gdb_put_char = putter;
+}
+
+void gdb_set_read(unsigned (*reader)(unsigned char *buf, unsigned n)) {
+    _gdb_read = reader;
+}
+
+void gdb_set_write(void (*writer)(const unsigned char *buf, unsigned n)) {
+    _gdb_write = writer;
+}
+#endif
+
+#ifdef DBG_RUNTIME_BUFFER
+void gdb_set_buffer(void *ptr, unsigned size) {
+    if (size <= MIN_PACKET_SIZE)
+        return;
+    _gdb_packet_size = size - 1;
+    _gdb_buffer = ptr;
+}
+#endif
+
+#if defined(DBG_STACK_SIZE) && !defined(__SDCC_gbz80)
+void gdb_set_stack(void *ptr, unsigned size) {
+    _gdb_stack_top = (char *)ptr + size;
+}
+#endif
+
+#ifdef DBG_STATS
+void gdb_set_ticks(word (*ticks)(void)) {
+    _gdb_ticks = ticks;
+}
+#endif
+
+#ifdef DBG_TIMEOUT
+void gdb_set_get_char_timeout(int (*getter)(void)) {
+    _gdb_get_char_timeout = getter;
+}
+#endif
+
+#ifdef DBG_FLASH
+void gdb_set_flash(int (*erase)(void *addr, unsigned len),
+                   int (*program)(void *addr, const void *data, unsigned len)) {
+    _gdb_flash_erase = erase;
+    _gdb_flash_program = program;
+}
+#endif
+
 void gdb_set_enter(void (*func)(void)) {
     _gdb_enter_func = func;
 }
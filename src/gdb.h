@@ -23,12 +23,15 @@
 
 #include "lib.h"
 
+#ifndef export
 #define export(returntype, signature) { \
     returntype signature; \
     extern returntype __LIB__ signature; \
 }
+#endif
 
-/* These functions must be defined by the application */
+/* These functions must be defined by the application, unless DBG_TRANSPORT
+   is defined */
 unsigned char gdb_getDebugChar(void) FASTCALL;
 void gdb_putDebugChar(unsigned char ch) FASTCALL;
 
@@ -53,18 +56,62 @@ export(void, gdb_nmi (void) __naked);
 /* Jump to this function from INT handler. Just replace EI+RETI instructions by
    JP _gdb_int
    Use if INT detects request to enter to debug mode.
+   With DBG_LIVE it also serves memory read requests of the running program.
  */
 export(void, gdb_int (void) __naked);
 
+/* Jump to this function from a periodic INT handler in place of EI+RETI
+   to sample PC of the program, requires DBG_PROFILER.
+ */
+export(void, gdb_sample (void) __naked);
+
 /* Prints to debugger console. */
 export(void, gdb_print(const char *str));
 
-/* Set the function which gets a packet character. This is required. */
+#ifdef DBG_TRANSPORT
+/* Set the function which gets a packet character, requires DBG_TRANSPORT.
+   Either it or the read function must be set. */
 export(void, gdb_set_get_char(unsigned char (*getter)(void)));
 
-/* Set the function which puts a packet character. This is required. */
+/* Set the function which puts a packet character, requires DBG_TRANSPORT.
+   Either it or the write function must be set. */
 export(void, gdb_set_put_char(void (*putter)(unsigned char)));
 
+/* Set the function which reads up to n already received bytes to buf and
+   returns their number, requires DBG_TRANSPORT. It must wait until at
+   least one byte is received, with DBG_TIMEOUT it returns 0 after a timeout
+   instead. Replaces the get char function if set. */
+export(void, gdb_set_read(unsigned (*reader)(unsigned char *buf, unsigned n)));
+
+/* Set the function which sends n bytes from buf, requires DBG_TRANSPORT.
+   Replaces the put char function if set, outgoing packets are buffered
+   then. */
+export(void, gdb_set_write(void (*writer)(const unsigned char *buf, unsigned n)));
+#endif
+
+/* Set the function which returns a packet character or -1 if none is
+   received in a short time, requires DBG_TIMEOUT. It is used in place of
+   the get char function when a packet or an acknowledgement is pending. */
+export(void, gdb_set_get_char_timeout(int (*getter)(void)));
+
+/* Set the packet buffer of size bytes, requires DBG_RUNTIME_BUFFER. Packets
+   are limited to size - 1 bytes, GDB is told about it by qSupported. */
+export(void, gdb_set_buffer(void *ptr, unsigned size));
+
+/* Set the area of size bytes used as the dedicated stack of the stub,
+   requires DBG_STACK_SIZE. Call it before the stub is entered first time. */
+export(void, gdb_set_stack(void *ptr, unsigned size));
+
+/* Set the functions which erase len bytes of flash at addr and program
+   len bytes of data to flash at addr, requires DBG_FLASH. Both return 0 on
+   success. GDB erases whole blocks of flash regions of the memory map. */
+export(void, gdb_set_flash(int (*erase)(void *addr, unsigned len),
+                           int (*program)(void *addr, const void *data, unsigned len)));
+
+/* Set the function which returns a free running timer count, requires
+   DBG_STATS. "monitor stats" shows timer ticks spent in the stub then. */
+export(void, gdb_set_ticks(word (*ticks)(void)));
+
 /* Set the function which turns a software break in a particular location on or off */
 export(void, gdb_set_swbreak_toggle(int (*func)(int set, void *addr)));
 
@@ -35,6 +35,14 @@ int (*_gdb_toggle_swbreak)(int set, void *addr) = NULL;
 
 #undef EXPAND
 #undef DO_EXPAND
+
+#ifdef DBG_SWBREAK_TABLE
+/* Z0 and z0 edit the table of the stub, breakpoints are written to memory
+   when the program is resumed */
+#undef DBG_SWBREAK_PROC
+#define DBG_SWBREAK_PROC swbreak_toggle
+static int swbreak_toggle (int set, void *addr);
+#endif
 #endif /* DBG_SWBREAK */
 
 #ifdef DBG_HWBREAK
@@ -49,6 +57,59 @@ int (*_gdb_toggle_step)(int set) = NULL;
 extern void* DBG_MEMCPY (void *dest, const void *src, unsigned n);
 #endif
 
+#if defined(DBG_SOFTSTEP) && \
+    (!defined(DBG_SWBREAK) || defined(__SDCC_gbz80) || defined(__SDCC_ez80_adl))
+#undef DBG_SOFTSTEP
+#endif
+
+#if defined(DBG_SWBREAK_TABLE) && !defined(DBG_SWBREAK)
+#undef DBG_SWBREAK_TABLE
+#endif
+
+#if defined(DBG_COND) && (!defined(DBG_SOFTSTEP) || defined(DBG_MIN_SIZE))
+#undef DBG_COND
+#endif
+
+#if defined(DBG_LZ4) && defined(DBG_MIN_SIZE)
+#undef DBG_LZ4
+#endif
+
+/* qRcmd (monitor) commands */
+#if defined(DBG_PROFILER) || defined(DBG_STATS)
+#define DBG_MONITOR
+#endif
+
+#ifdef DBG_PROFILER
+byte _gdb_prof_on;
+word _gdb_prof_hist[DBG_PROFILER_BUCKETS];
+#endif
+
+#if defined(DBG_TRACE) && (!defined(DBG_SOFTSTEP) || \
+    !defined(DBG_SWBREAK_PROC) || !defined(DBG_SWBREAK_TABLE) || \
+    defined(DBG_MIN_SIZE))
+#undef DBG_TRACE
+#endif
+
+#ifdef DBG_STATS
+word (*_gdb_ticks)(void) = NULL;
+#endif
+
+#ifdef DBG_TIMEOUT
+int (*_gdb_get_char_timeout)(void) = NULL;
+#endif
+
+#ifdef DBG_FLASH
+int (*_gdb_flash_erase)(void *addr, unsigned len) = NULL;
+int (*_gdb_flash_program)(void *addr, const void *data, unsigned len) = NULL;
+#endif
+
+#ifdef DBG_TRANSPORT
+unsigned char (*_gdb_get_char)(void) = NULL;
+void (*_gdb_put_char)(unsigned char ch) = NULL;
+unsigned (*_gdb_read)(unsigned char *buf, unsigned n) = NULL;
+void (*_gdb_write)(const unsigned char *buf, unsigned n) = NULL;
+#endif
+
 #ifdef DBG_WWATCH
 extern int DBG_WWATCH(int set, void *addr, unsigned size);
 #endif
@@ -65,9 +126,51 @@ extern int DBG_AWATCH(int set, void *addr, unsigned size);
 
 byte _gdb_state[NUMREGBYTES];
 
-#if DBG_PACKET_SIZE < (NUMREGBYTES*2+5)
+#ifdef DBG_STACK_SIZE
+#if DBG_STACK_SIZE > 0
+char _gdb_stack[DBG_STACK_SIZE];
+#ifndef __SDCC_gbz80
+char *_gdb_stack_top = _gdb_stack + DBG_STACK_SIZE;
+#endif
+#else
+/* set by gdb_set_stack() */
+char *_gdb_stack_top;
+#endif
+#endif /* DBG_STACK_SIZE */
+
+#ifdef DBG_USE_TRAMPOLINE
+/* JP instruction to the resume address */
+static byte trampoline[1 + REG_SIZE];
+#endif
+
+#ifdef DBG_RUNTIME_BUFFER
+char *_gdb_buffer;
+unsigned _gdb_packet_size;
+#define PACKET_SIZE _gdb_packet_size
+#else
+#if DBG_PACKET_SIZE < MIN_PACKET_SIZE
 #error "Too small DBG_PACKET_SIZE"
 #endif
+#define PACKET_SIZE DBG_PACKET_SIZE
+#endif /* DBG_RUNTIME_BUFFER */
+
+/* packet size reported to GDB: when neither memory reads nor writes pass
+   through the packet buffer, it does not limit them; vFlashWrite is always
+   received to the buffer, flash is programmed after the checksum is right */
+#if defined(DBG_STREAM) && defined(DBG_STREAM_WRITE) && !defined(DBG_FLASH)
+#ifndef DBG_STREAM_PACKET_SIZE
+#define DBG_STREAM_PACKET_SIZE 4096
+#endif
+#ifdef DBG_FEATURE_STR
+/* target description is sent in one reply */
+#define REPORTED_PACKET_SIZE (sizeof(DBG_FEATURE_STR) + 4 > DBG_STREAM_PACKET_SIZE ? \
+                              sizeof(DBG_FEATURE_STR) + 4 : DBG_STREAM_PACKET_SIZE)
+#else
+#define REPORTED_PACKET_SIZE DBG_STREAM_PACKET_SIZE
+#endif
+#else
+#define REPORTED_PACKET_SIZE PACKET_SIZE
+#endif
 
 #ifndef DBG_ENTER
 #define DBG_ENTER
@@ -81,9 +184,300 @@ void (*_gdb_enter_func)(void) = NULL;
 
 static signed char sigval;
 static unsigned char first_entry = 0;
+#ifdef DBG_LIVE
+/* 1 while a packet received by _gdb_live_main is handled */
+static byte live;
+/* '$' of the packet has been read already */
+static byte live_start;
+#endif
+#ifndef DBG_MIN_SIZE
+/* 0: packets are acknowledged, 1: reply to QStartNoAckMode is being sent,
+   2: acknowledgements are disabled */
+static byte no_ack;
+#define put_ack(ch) (no_ack != 2 ? put_char (ch) : (void)0)
+#else
+#define put_ack(ch) put_char (ch)
+#endif
+/* length of the reply in the packet buffer, binary replies may contain '\0' */
+static unsigned reply_len;
+#ifndef DBG_MIN_SIZE
+/* length of the received packet, binary packets may contain '\0' */
+static unsigned packet_len;
+#endif
+/* checksum of the packet being sent */
+static char tx_checksum;
+#ifdef DBG_STREAM
+/* reply data which is sent after the buffer contents directly from memory */
+#define STREAM_HEX	1	/* send data hex encoded */
+#define STREAM_TARGET	2	/* read data using DBG_MEMCPY */
+static const byte *stream_addr;
+static unsigned stream_len;
+static byte stream_mode;
+#endif
+#ifdef DBG_STREAM_WRITE
+/* state of X or M packet payload written while it is received */
+static signed char write_status; /* -1: not written, 0: success, >0: error */
+static byte *write_addr;
+static unsigned write_len;
+static byte write_hex;
+static byte write_val;
+#ifdef DBG_MEMCPY
+static byte write_tmp[16];
+static byte write_tlen;
+#endif
+static signed char write_begin (const char *buffer) FASTCALL;
+static void write_byte (byte v) FASTCALL;
+static void write_end (void);
+#endif /* DBG_STREAM_WRITE */
+#ifdef DBG_FLASH
+/* block of flash being collected from vFlashWrite packets */
+static byte flash_buf[DBG_FLASH];
+static byte *flash_addr;
+static unsigned flash_lo; /* written bytes of flash_buf */
+static unsigned flash_hi;
+static signed char flash_write (byte *addr, const byte *data, unsigned len);
+#endif /* DBG_FLASH */
+#if defined(DBG_SOFTSTEP) || defined(DBG_SWBREAK_TABLE)
+#ifdef DBG_SWBREAK_RST
+#define BREAK_SIZE 1
+#else
+#define BREAK_SIZE 3
+#endif
+#endif
+#ifdef DBG_SWBREAK_TABLE
+/* software breakpoints sorted by address */
+#define SWBREAK_GDB	1	/* set by Z0 */
+#define SWBREAK_TRACE	2	/* tracepoint */
+#define SWBREAK_USED	(SWBREAK_GDB | SWBREAK_TRACE)
+#define SWBREAK_OVER	4	/* not written while it is stepped over */
+static struct {
+  byte *addr;
+  byte save[BREAK_SIZE];
+  byte inserted;
+  byte owner;
+} swbreak_table[DBG_SWBREAK_TABLE];
+static byte swbreak_count;
+static void swbreak_patch (void);
+static void swbreak_unpatch (void);
+static byte swbreak_find (const byte *addr) FASTCALL;
+static byte swbreak_owner (const byte *addr) FASTCALL;
+#endif /* DBG_SWBREAK_TABLE */
+#ifdef DBG_SOFTSTEP
+/* temporary breakpoint planted by the software stepper */
+static byte *step_addr;
+static byte step_save[BREAK_SIZE];
+static byte step_set;
+/* range of vCont;r action, stepping continues while PC is inside */
+static const byte *range_start;
+static const byte *range_end;
+static void step_remove (void);
+#ifdef DBG_LIVE
+static void step_hide (byte hide) FASTCALL;
+#endif
+#endif /* DBG_SOFTSTEP */
+#ifdef DBG_COND
+#ifndef DBG_COND_COUNT
+#define DBG_COND_COUNT 4
+#endif
+#ifndef DBG_COND_SIZE
+#define DBG_COND_SIZE 32
+#endif
+#ifndef DBG_AX_STACK
+#define DBG_AX_STACK 8
+#endif
+/* conditions of breakpoints: agent expressions, each one is preceded by
+   its length, list is terminated by zero length; free entry has zero length
+   of the first expression */
+static struct {
+  const byte *addr;
+  byte code[DBG_COND_SIZE];
+} cond_table[DBG_COND_COUNT];
+static void cond_check (void);
+#endif /* DBG_COND */
+#ifdef DBG_TRACE
+#ifndef DBG_TRACE_COUNT
+#define DBG_TRACE_COUNT 4
+#endif
+#ifndef DBG_TRACE_MEM
+#define DBG_TRACE_MEM 2
+#endif
+#ifndef DBG_TRACE_BUFFER
+#define DBG_TRACE_BUFFER 512
+#endif
+/* tracepoints defined by QTDP packets */
+static struct {
+  const byte *addr;
+  word number;
+  word pass;
+  word hits;
+  byte enabled;
+  byte mem_count;
+  /* memory ranges to collect, reg is 0xff for absolute address */
+  struct {
+    byte reg;
+    word offset;
+    word len;
+  } mem[DBG_TRACE_MEM];
+} trace_table[DBG_TRACE_COUNT];
+static byte trace_count;
+/* ring buffer of frames: header, registers and collected memory blocks */
+static byte trace_buf[DBG_TRACE_BUFFER];
+static word trace_head;
+static word trace_used;
+static word trace_frames;
+static word trace_created;
+static byte trace_circular;
+static byte trace_running;
+static byte trace_reason;
+static word trace_reason_tp;
+/* frame selected by QTFrame, g, m and x read it instead of the target */
+#define TRACE_NONE 0xffff
+static word trace_frame = TRACE_NONE;
+static word trace_frame_pos;
+static void trace_check (void);
+static signed char process_trace (char *buffer) FASTCALL;
+static signed char trace_g (char *buffer) FASTCALL;
+static signed char trace_p (char *buffer, byte n);
+static signed char trace_m (char *buffer, const byte *addr, unsigned len, byte binary);
+#endif /* DBG_TRACE */
+#if defined(DBG_COND) || defined(DBG_TRACE)
+/* breakpoint which is being stepped over without stopping */
+static const byte *over_addr;
+static signed char over_type;
+static void over_check (void);
+#endif
+#ifdef DBG_RLE
+/* pending run of repeated characters */
+static char rle_ch;
+static byte rle_count;
+#endif
 
 static char put_packet_info (const char *buffer) FASTCALL;
 
+#ifdef DBG_STATS
+/* commands counted separately, others are counted in the last item */
+static const char stats_names[] = "?cDgGkmMpPqQsvxXzZ";
+/* counters of the packet engine shown by "monitor stats" */
+static struct {
+  unsigned long bytes_in;
+  unsigned long bytes_out;
+  unsigned long ticks;	/* spent in the stub, counted by _gdb_ticks */
+  word packets_in;
+  word packets_out;
+  word naks;		/* received packets rejected */
+  word bad_csum;	/* of them with wrong checksum */
+  word retransmits;	/* sent packets rejected by GDB */
+  word commands[sizeof(stats_names)];
+} stats;
+static word stats_enter;
+#define STATS_INC(counter) (void)++stats.counter
+#else
+#define STATS_INC(counter) (void)0
+#endif /* DBG_STATS */
+
+#ifdef DBG_TRANSPORT
+#ifndef DBG_TX_BUFFER_SIZE
+#define DBG_TX_BUFFER_SIZE 32
+#endif
+#ifndef DBG_RX_BUFFER_SIZE
+#define DBG_RX_BUFFER_SIZE 32
+#endif
+#if DBG_TX_BUFFER_SIZE > 255 || DBG_RX_BUFFER_SIZE > 255
+#error "DBG_TX_BUFFER_SIZE and DBG_RX_BUFFER_SIZE must be less than 256"
+#endif
+static byte tx_buf[DBG_TX_BUFFER_SIZE];
+static byte tx_count;
+static byte rx_buf[DBG_RX_BUFFER_SIZE];
+static byte rx_pos;
+static byte rx_count;
+
+static void put_flush (void) {
+  if (tx_count != 0)
+    {
+      _gdb_write (tx_buf, tx_count);
+      tx_count = 0;
+    }
+}
+
+static void put_char (byte ch) FASTCALL {
+  STATS_INC (bytes_out);
+  if (!_gdb_write)
+    {
+      _gdb_put_char (ch);
+      return;
+    }
+  tx_buf[tx_count++] = ch;
+  if (tx_count == sizeof(tx_buf))
+    put_flush ();
+}
+
+static byte get_char (void) {
+  STATS_INC (bytes_in);
+  /* never wait for data while something is not sent */
+  put_flush ();
+  if (!_gdb_read)
+    return _gdb_get_char ();
+  if (rx_pos == rx_count)
+    {
+      rx_pos = 0;
+      /* the reader returns 0 on timeout with DBG_TIMEOUT */
+      while ((rx_count = _gdb_read (rx_buf, sizeof(rx_buf))) == 0)
+        ;
+    }
+  return rx_buf[rx_pos++];
+}
+#elif defined(DBG_STATS)
+#define get_char() (STATS_INC (bytes_in), gdb_getDebugChar())
+#define put_char(ch) (STATS_INC (bytes_out), gdb_putDebugChar(ch))
+#define put_flush()
+#else
+#define get_char() gdb_getDebugChar()
+#define put_char(ch) gdb_putDebugChar(ch)
+#define put_flush()
+#endif /* DBG_TRANSPORT */
+
+#ifdef DBG_TIMEOUT
+/* return character which comes before DBG_TIMEOUT timeouts of the receive
+   function or -1, wait forever if there is no such function */
+static int get_char_timeout (void) {
+  byte n = DBG_TIMEOUT;
+  int c;
+#ifdef DBG_TRANSPORT
+  put_flush ();
+  if (_gdb_read)
+    {
+      if (rx_pos != rx_count)
+        return get_char ();
+      do
+        {
+          rx_pos = 0;
+          rx_count = _gdb_read (rx_buf, sizeof(rx_buf));
+          if (rx_count != 0)
+            return get_char ();
+        }
+      while (--n != 0);
+      return -1;
+    }
+#endif
+  if (!_gdb_get_char_timeout)
+    return get_char ();
+  do
+    {
+      c = _gdb_get_char_timeout ();
+      if (c >= 0)
+        {
+          STATS_INC (bytes_in);
+          return c;
+        }
+    }
+  while (--n != 0);
+  return -1;
+}
+#define packet_char() get_char_timeout ()
+#else
+#define packet_char() get_char ()
+#endif /* DBG_TIMEOUT */
+
 /************** UTILITY FUNCTIONS ********************/
 static char low_hex (byte v) FASTCALL {
   v &= 0x0f;
@@ -103,6 +497,143 @@ static char * byte2hex (char *p, byte v) {
   return p;
 }
 
+#if defined(DBG_FAST_HEX) && !defined(__SDCC_gbz80)
+/* Hand written hex codec, arguments and results are passed in globals.
+   Inner loops take 185 T-states per byte in mem2hex and 193 T-states
+   per byte in hex2mem. */
+char *_gdb_hex_buf;
+byte *_gdb_hex_mem;
+unsigned _gdb_hex_len;
+
+static void mem2hex_fast (void) __naked {
+  __asm
+	ld	de, (__gdb_hex_len)
+	ld	a, d
+	or	a, e
+	jr	z, gdb_mem2hex_end
+	ld	b, e	;B - count modulo 256, A - number of 256 byte blocks
+	dec	de
+	inc	d
+	ld	a, d
+	ld	hl, (__gdb_hex_mem)
+	ld	de, (__gdb_hex_buf)
+gdb_mem2hex_block:
+	push	af
+gdb_mem2hex_loop:
+	ld	a, (hl)
+	inc	hl
+	push	hl
+	ld	c, a	;C - byte being converted
+	rrca
+	rrca
+	rrca
+	rrca
+	and	a, 0x0f
+	ld	hl, gdb_hex_digits
+	add	a, l
+	ld	l, a
+	adc	a, h
+	sub	a, l
+	ld	h, a
+	ld	a, (hl)
+	ld	(de), a
+	inc	de
+	ld	a, c
+	and	a, 0x0f
+	ld	hl, gdb_hex_digits
+	add	a, l
+	ld	l, a
+	adc	a, h
+	sub	a, l
+	ld	h, a
+	ld	a, (hl)
+	ld	(de), a
+	inc	de
+	pop	hl
+	djnz	gdb_mem2hex_loop
+	pop	af
+	dec	a
+	jr	nz, gdb_mem2hex_block
+	ld	(__gdb_hex_buf), de
+gdb_mem2hex_end:
+	ld	hl, (__gdb_hex_buf)
+	ld	(hl), 0
+	ret
+gdb_hex_digits:
+	defb	0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37
+	defb	0x38, 0x39, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66
+  __endasm;
+}
+
+static void hex2mem_fast (void) __naked {
+  __asm
+	ld	de, (__gdb_hex_len)
+	ld	a, d
+	or	a, e
+	ret	z
+	ld	b, e	;B - count modulo 256, A - number of 256 byte blocks
+	dec	de
+	inc	d
+	ld	a, d
+	push	ix
+	ld	ix, (__gdb_hex_mem)
+	ld	hl, (__gdb_hex_buf)
+	ld	de, gdb_hex_values
+gdb_hex2mem_block:
+	push	af
+gdb_hex2mem_loop:
+	ld	a, (hl)
+	inc	hl
+	ld	c, (hl)
+	inc	hl
+	push	hl
+	and	a, 0x1f
+	ld	l, a
+	ld	h, 0
+	add	hl, de
+	ld	a, (hl)
+	add	a, a
+	add	a, a
+	add	a, a
+	add	a, a
+	ld	l, a
+	ld	a, c
+	ld	c, l	;C - high nibble
+	and	a, 0x1f
+	ld	l, a
+	ld	h, 0
+	add	hl, de
+	ld	a, (hl)
+	or	a, c
+	ld	(ix+0), a
+	inc	ix
+	pop	hl
+	djnz	gdb_hex2mem_loop
+	pop	af
+	dec	a
+	jr	nz, gdb_hex2mem_block
+	ld	(__gdb_hex_buf), hl
+	pop	ix
+	ret
+;digit values indexed by (digit & 0x1f), it is the same for both letter cases
+gdb_hex_values:
+	defb	0, 10, 11, 12, 13, 14, 15, 0
+	defb	0, 0, 0, 0, 0, 0, 0, 0
+	defb	0, 1, 2, 3, 4, 5, 6, 7
+	defb	8, 9
+  __endasm;
+}
+
+/* convert the memory, pointed to by mem into hex, placing result in buf */
+/* return a pointer to the last char put in buf (null) */
+static char * mem2hex (char *buf, const byte *mem, unsigned bytes) {
+  _gdb_hex_buf = buf;
+  _gdb_hex_mem = (byte *)mem;
+  _gdb_hex_len = bytes;
+  mem2hex_fast ();
+  return _gdb_hex_buf;
+}
+#else
 /* convert the memory, pointed to by mem into hex, placing result in buf */
 /* return a pointer to the last char put in buf (null) */
 static char * mem2hex (char *buf, const byte *mem, unsigned bytes) {
@@ -118,6 +649,7 @@ static char * mem2hex (char *buf, const byte *mem, unsigned bytes) {
   *d = 0;
   return d;
 }
+#endif /* DBG_FAST_HEX */
 
 static signed char hex2val (unsigned char hex) FASTCALL {
   if (hex <= '9')
@@ -127,6 +659,17 @@ static signed char hex2val (unsigned char hex) FASTCALL {
   return (hex >= 10 && hex < 16) ? hex : -1;
 }
 
+#if defined(DBG_FAST_HEX) && !defined(__SDCC_gbz80)
+/* convert the hex array pointed to by buf into binary, to be placed in mem
+   return a pointer to the character after the last byte written */
+static char *hex2mem (byte *mem, char *buf, unsigned bytes) {
+  _gdb_hex_buf = buf;
+  _gdb_hex_mem = mem;
+  _gdb_hex_len = bytes;
+  hex2mem_fast ();
+  return _gdb_hex_buf;
+}
+#else
 static int hex2byte (const char *p) FASTCALL {
   signed char h = hex2val (p[0]);
   signed char l = hex2val (p[1]);
@@ -149,6 +692,7 @@ static char *hex2mem (byte *mem, char *buf, unsigned bytes) {
     }
   return buf;
 }
+#endif /* DBG_FAST_HEX */
 
 static int hex2int (const char **buf) FASTCALL {
   word r = 0;
@@ -170,47 +714,115 @@ static char * int2hex (char *buf, int v) {
 }
 /******************************************************************************/
 static void store_pc_sp (int pc_adj) FASTCALL;
+#ifndef get_reg_value
 #define get_reg_value(mem) (*(void* const*)(mem))
 #define set_reg_value(mem,val) do { (*(void**)(mem) = (val)); } while (0)
+#endif
 static void get_packet (char *buffer);
 static void put_packet (const char *buffer);
+static void resume (void);
 static char process (char *buffer) FASTCALL;
 
-#ifdef DBG_PRINT
-void gdb_print(const char *str) {
-    gdb_putDebugChar('$');
-    gdb_putDebugChar('O');
+#if defined(DBG_PRINT) || defined(DBG_MONITOR)
+/* send text to the debugger console in O packet */
+static void put_console (const char *str) {
+    put_char ('$');
+    put_char ('O');
     char csum = 'O';
     for (; *str != '\0'; ) {
         char c = high_hex (*str);
         csum += c;
-        gdb_putDebugChar (c);
+        put_char (c);
         c = low_hex (*str++);
         csum += c;
-        gdb_putDebugChar (c);
+        put_char (c);
     }
-    gdb_putDebugChar('#');
-    gdb_putDebugChar(high_hex (csum));
-    gdb_putDebugChar(low_hex (csum));
+    put_char ('#');
+    put_char (high_hex (csum));
+    put_char (low_hex (csum));
+    put_flush ();
+}
+#endif /* DBG_PRINT || DBG_MONITOR */
+
+#ifdef DBG_PRINT
+void gdb_print(const char *str) {
+    put_console (str);
 }
 #endif /* DBG_PRINT */
 
+/* write breakpoints and continue execution of the program */
+static void resume (void) {
+#ifdef DBG_SWBREAK_TABLE
+  swbreak_patch ();
+#endif
+#ifdef DBG_STATS
+  if (_gdb_ticks)
+    stats.ticks += (word)(_gdb_ticks () - stats_enter);
+#endif
+  DBG_TICKS_MARK (DBG_TICKS_LEAVE);
+  _gdb_rest_cpu_state ();
+}
+
 void _gdb_stub_main (int ex, int pc_adj) {
+#ifdef DBG_RUNTIME_BUFFER
+  char *buffer = _gdb_buffer;
+#else
   char buffer[DBG_PACKET_SIZE+1];
+#endif
+#ifdef DBG_STATS
+  if (_gdb_ticks)
+    stats_enter = _gdb_ticks ();
+#endif
   sigval = (signed char)ex;
   store_pc_sp (pc_adj);
+  DBG_TICKS_MARK (DBG_TICKS_ENTER);
+#ifdef DBG_SWBREAK_TABLE
+  swbreak_unpatch ();
+#endif
+#ifdef DBG_SOFTSTEP
+  if (step_set)
+    step_remove ();
+#endif
+#if defined(DBG_COND) || defined(DBG_TRACE)
+  over_check ();
+#endif
+#ifdef DBG_TRACE
+  trace_check ();
+#endif
+#ifdef DBG_COND
+  cond_check ();
+#endif
+#ifdef DBG_SWBREAK_TABLE
+  if (sigval == EX_SWBREAK)
+    {
+      /* entry is not caused by one of breakpoints set by GDB */
+      const byte *pc = get_reg_value (&_gdb_state[R_PC]);
+      if (!(swbreak_owner (pc) & SWBREAK_GDB))
+        sigval = EX_SIGTRAP;
+    }
+#endif
 
   DBG_ENTER
 
+#ifdef DBG_TRANSPORT
+  if((!_gdb_get_char && !_gdb_read) || (!_gdb_put_char && !_gdb_write)) {
+    resume ();
+  }
+#else
   if(!gdb_getDebugChar || !gdb_putDebugChar) {
-    _gdb_rest_cpu_state();
+    resume ();
   }
+#endif
+#ifdef DBG_RUNTIME_BUFFER
+  if (!buffer)
+    resume ();
+#endif
 
   if(!first_entry) {
     // put some extra bytes on the line to fill the cable's buffer
     first_entry = 1;
-    gdb_putDebugChar(0);
-    gdb_putDebugChar(0);
+    put_char (0);
+    put_char (0);
   }
 
   #if defined(DBG_SWBREAK) && defined(DBG_TOGGLESTEP)
@@ -223,35 +835,105 @@ void _gdb_stub_main (int ex, int pc_adj) {
   *buffer = '?';
   for (; process (buffer);)
     {
+      DBG_TICKS_MARK (DBG_TICKS_PUT_PACKET);
       put_packet (buffer);
+      DBG_TICKS_MARK (DBG_TICKS_PUT_PACKET_END);
+      DBG_TICKS_MARK (DBG_TICKS_GET_PACKET);
       get_packet (buffer);
+      DBG_TICKS_MARK (DBG_TICKS_GET_PACKET_END);
     }
+  DBG_TICKS_MARK (DBG_TICKS_PUT_PACKET);
   put_packet (buffer);
-  _gdb_rest_cpu_state ();
+  DBG_TICKS_MARK (DBG_TICKS_PUT_PACKET_END);
+  resume ();
+}
+
+#ifdef DBG_LIVE
+/* packets which do not change state of the program */
+static byte live_packet (const char *buffer) FASTCALL {
+  return *buffer == 'm' || *buffer == 'x' || memcmp (buffer, "qCRC:", 5) == 0;
+}
+
+/* entry from gdb_int: reply to a packet which only reads memory and
+   continue the program, enter the stub on anything else */
+void _gdb_live_main (int ex, int pc_adj) {
+#ifdef DBG_RUNTIME_BUFFER
+  char *buffer = _gdb_buffer;
+#else
+  char buffer[DBG_PACKET_SIZE+1];
+#endif
+#ifdef DBG_STATS
+  if (_gdb_ticks)
+    stats_enter = _gdb_ticks ();
+#endif
+  if (first_entry && get_char () == '$')
+    {
+      live = live_start = 1;
+      /* replies show program code under breakpoints, which are written
+         back by resume() */
+#ifdef DBG_SWBREAK_TABLE
+      swbreak_unpatch ();
+#endif
+#ifdef DBG_SOFTSTEP
+      step_hide (1);
+#endif
+      get_packet (buffer);
+      if (!live_packet (buffer))
+        *buffer = '\0';
+      process (buffer);
+      put_packet (buffer);
+      live = 0;
+      store_pc_sp (pc_adj);
+#ifdef DBG_SOFTSTEP
+      step_hide (0);
+#endif
+      resume ();
+    }
+  _gdb_stub_main (ex, pc_adj);
 }
+#endif /* DBG_LIVE */
 
 static void get_packet (char *buffer) {
   byte csum;
   char ch;
   char *p;
   byte esc;
-#if DBG_PACKET_SIZE <= 256
+#if !defined(DBG_RUNTIME_BUFFER) && DBG_PACKET_SIZE <= 256
   byte count; /* it is OK to use up to 256 here */
 #else
   unsigned count;
 #endif
-  for (;; gdb_putDebugChar ('-'))
+  for (;; STATS_INC (naks), put_ack ('-'))
     {
       /* wait for packet start character */
-      while((ch = gdb_getDebugChar()) != '$');
+#ifdef DBG_LIVE
+      if (live_start)
+	{
+	  /* '$' has been read by _gdb_live_main */
+	  live_start = 0;
+	  ch = '$';
+	}
+      else
+#endif
+      while((ch = get_char ()) != '$');
 retry:
       csum = 0;
       esc = 0;
       p = buffer;
-      count = DBG_PACKET_SIZE;
+      count = PACKET_SIZE;
+#ifdef DBG_STREAM_WRITE
+      write_status = -1;
+#endif
       do
 	{
-	  ch = gdb_getDebugChar();
+#ifdef DBG_TIMEOUT
+	  const int c = get_char_timeout ();
+	  if (c < 0)
+	    goto finish; /* the rest is lost, ch is not '#' */
+	  ch = (char)c;
+#else
+	  ch = get_char ();
+#endif
 	  switch (ch)
 	    {
 	    case '$':
@@ -262,85 +944,338 @@ retry:
 	      esc = 0x20;
 	      break;
 	    default:
+#ifdef DBG_STREAM_WRITE
+	      if (write_status >= 0)
+		{
+		  /* payload goes to memory, not to the buffer */
+		  write_byte (ch ^ esc);
+		  esc = 0;
+		  break;
+		}
+#endif
 	      *p++ = ch ^ esc;
 	      esc = 0;
 	      --count;
+#ifdef DBG_STREAM_WRITE
+	      if (ch == ':' && (*buffer == 'X' || *buffer == 'M'))
+		{
+		  *p = '\0';
+		  write_status = write_begin (buffer);
+		}
+#endif
 	    }
 	  csum += ch;
 	}
       while (count != 0);
 finish:
       *p = '\0';
+#ifndef DBG_MIN_SIZE
+      packet_len = p - buffer;
+#endif
       if (ch != '#') /* packet is too large */
 	continue;
-      ch = gdb_getDebugChar();
-      if (ch != high_hex (csum))
-	continue;
-      ch = gdb_getDebugChar();
-      if (ch != low_hex (csum))
-	continue;
-      break;
+#ifdef DBG_STREAM_WRITE
+      if (write_status >= 0)
+	write_end ();
+#endif
+      ch = packet_char ();
+      if (ch == high_hex (csum) && packet_char () == low_hex (csum))
+	break;
+      STATS_INC (bad_csum);
+    }
+  STATS_INC (packets_in);
+  put_ack ('+');
+  put_flush ();
+}
+
+#ifdef DBG_STREAM_WRITE
+/* parse "Xaddr,length:" or "Maddr,length:" header of the packet being
+   received and prepare to write its payload */
+static signed char write_begin (const char *buffer) FASTCALL {
+  const char *p = &buffer[1];
+#ifdef DBG_LIVE
+  /* memory of the running program is not written */
+  if (live)
+    return -1;
+#endif
+  write_hex = (*buffer == 'M');
+#ifdef DBG_MEMCPY
+  write_tlen = 0;
+#endif
+  write_addr = (void*)hex2int(&p);
+  if (*p++ != ',')
+    return 1;
+  write_len = (unsigned)hex2int(&p);
+  if (*p != ':')
+    return 2;
+  return 0;
+}
+
+#ifdef DBG_MEMCPY
+static void write_flush (void) {
+  if (write_tlen == 0)
+    return;
+  if (!DBG_MEMCPY(write_addr, write_tmp, write_tlen) && write_status == 0)
+    write_status = 4;
+  write_addr += write_tlen;
+  write_tlen = 0;
+}
+#endif /* DBG_MEMCPY */
+
+/* store unescaped payload character */
+static void write_byte (byte v) FASTCALL {
+  if (write_status != 0)
+    return; /* drop rest of the payload after an error */
+  if (write_hex)
+    {
+      signed char n = hex2val (v);
+      if (n < 0)
+	{
+	  write_status = 3;
+	  return;
+	}
+      write_hex ^= 2; /* high nibble is pending */
+      if (write_hex & 2)
+	{
+	  write_val = (byte)n << 4;
+	  return;
+	}
+      v = write_val | (byte)n;
+    }
+  if (write_len == 0)
+    {
+      write_status = 3;
+      return;
     }
-  gdb_putDebugChar('+');
+  --write_len;
+#ifdef DBG_MEMCPY
+  write_tmp[write_tlen++] = v;
+  if (write_tlen == sizeof(write_tmp))
+    write_flush ();
+#else
+  *write_addr++ = v;
+#endif
+}
+
+static void write_end (void) {
+#ifdef DBG_MEMCPY
+  write_flush ();
+#endif
+  if (write_status == 0 && (write_len != 0 || (write_hex & 2)))
+    write_status = 3;
 }
+#endif /* DBG_STREAM_WRITE */
 
 static void put_packet (const char *buffer) {
   /*  $<packet info>#<checksum>. */
+#ifdef DBG_TIMEOUT
+  byte retries = DBG_RETRIES;
+#endif
+  STATS_INC (packets_out);
   for (;;)
     {
-      gdb_putDebugChar('$');
+      put_char ('$');
       char checksum = put_packet_info (buffer);
-      gdb_putDebugChar('#');
-      gdb_putDebugChar(high_hex(checksum));
-      gdb_putDebugChar(low_hex(checksum));
+      put_char ('#');
+      put_char (high_hex(checksum));
+      put_char (low_hex(checksum));
+      put_flush ();
+#ifndef DBG_MIN_SIZE
+      if (no_ack == 2)
+	return;
+#endif
       for (;;)
 	{
-	  char c = gdb_getDebugChar ();
+#ifdef DBG_TIMEOUT
+	  /* no acknowledgement is the same as '-' */
+	  const int c = get_char_timeout ();
+#else
+	  char c = get_char ();
+#endif
 	  switch (c)
 	    {
-	    case '+': return;
-	    case '-': break;
+	    case '+':
+#ifndef DBG_MIN_SIZE
+	      /* GDB has acknowledged OK reply to QStartNoAckMode */
+	      if (no_ack)
+		no_ack = 2;
+#endif
+	      return;
+#ifdef DBG_TIMEOUT
+	    case -1:
+#endif
+	    case '-':
+	      STATS_INC (retransmits);
+	      break;
 	    default:
 	      //gdb_putDebugChar(c);
 	      continue;
 	    }
 	  break;
 	}
+#ifdef DBG_TIMEOUT
+      /* give up, GDB will ask again if it is still there */
+      if (retries-- == 0)
+	{
+#ifndef DBG_MIN_SIZE
+	  /* GDB has switched to no-ack mode after QStartNoAckMode anyway */
+	  if (no_ack)
+	    no_ack = 2;
+#endif
+	  return;
+	}
+#endif
     }
 }
 
-static char put_packet_info (const char *src) FASTCALL {
-  char ch;
-  char checksum = 0;
-  for (;;)
+/* send character as is, accounting it in packet checksum */
+static void put_raw (char ch) FASTCALL {
+  tx_checksum += ch;
+  put_char (ch);
+}
+
+/* send character escaping it if required */
+static void put_escaped (char ch) FASTCALL {
+  if (ch == '}' || ch == '*' || ch == '#' || ch == '$')
     {
-      ch = *src++;
-      if (ch == '\0')
-	break;
-      if (ch == '}' || ch == '*' || ch == '#' || ch == '$')
-	{
-	  /* escape special characters */
-	  gdb_putDebugChar('}');
-	  checksum += '}';
-	  ch ^= 0x20;
-	}
-      gdb_putDebugChar(ch);
-      checksum += ch;
+      /* escape special characters */
+      put_raw ('}');
+      ch ^= 0x20;
     }
-  return checksum;
+  put_raw (ch);
 }
 
-static void store_pc_sp (int pc_adj) FASTCALL {
-  byte *sp = get_reg_value (&_gdb_state[R_SP]);
-  byte *pc = get_reg_value (sp);
-  pc += pc_adj;
-  set_reg_value (&_gdb_state[R_PC], pc);
-  set_reg_value (&_gdb_state[R_SP], sp + REG_SIZE);
+#ifdef DBG_RLE
+/* send pending run of characters as "c*n", where n-29 is the number
+   of additional repeats */
+static void rle_flush (void) {
+  byte n = rle_count;
+  if (n == 0)
+    return;
+  rle_count = 0;
+  put_raw (rle_ch);
+  --n;
+  if (n >= 3)
+    {
+      byte r = n;
+      /* repeat counts 6 and 7 are encoded as '#' and '$' */
+      if (r == 6 || r == 7)
+	r = 5;
+      put_raw ('*');
+      put_raw (r + 29);
+      n -= r;
+    }
+  for (; n != 0; --n)
+    put_raw (rle_ch);
 }
 
-static char *hex2mem (byte *mem, char *buf, unsigned bytes);
-
-/* Command processors. Takes pointer to buffer (begins from command symbol),
+/* send packet data character, collecting runs of repeated characters */
+static void put_data (char ch) FASTCALL {
+  if (rle_count != 0 && ch == rle_ch && rle_count < 98)
+    {
+      ++rle_count;
+      return;
+    }
+  rle_flush ();
+  if (ch == '}' || ch == '*' || ch == '#' || ch == '$')
+    {
+      /* escaped characters are never repeated */
+      put_escaped (ch);
+      return;
+    }
+  rle_ch = ch;
+  rle_count = 1;
+}
+#else
+#define put_data put_escaped
+#endif /* DBG_RLE */
+
+#ifdef DBG_STREAM
+static void put_stream_data (const byte *src, unsigned n) {
+#if defined(DBG_FAST_HEX) && !defined(__SDCC_gbz80)
+  if (stream_mode & STREAM_HEX)
+    {
+      /* encode blocks with the fast codec, only framing is per character */
+      char hex[2*16+1];
+      while (n != 0)
+	{
+	  const char *p = hex;
+	  const unsigned k = n < 16 ? n : 16;
+	  const char *end = mem2hex (hex, src, k);
+	  src += k;
+	  n -= k;
+	  while (p != end)
+	    put_data (*p++);
+	}
+      return;
+    }
+#endif
+  for (; n != 0; --n)
+    {
+      byte v = *src++;
+      if (stream_mode & STREAM_HEX)
+	{
+	  put_data (high_hex (v));
+	  put_data (low_hex (v));
+	}
+      else
+	put_data (v);
+    }
+}
+
+/* encode streamed reply straight from its source, it is done on every
+   retransmission so the reply never has to fit the packet buffer */
+static void put_stream (void) {
+  const byte *addr = stream_addr;
+  unsigned len = stream_len;
+#ifdef DBG_MEMCPY
+  if (stream_mode & STREAM_TARGET)
+    {
+      while (len != 0)
+	{
+	  byte tmp[16];
+	  unsigned tlen = sizeof(tmp);
+	  if (tlen > len)
+	    tlen = len;
+	  /* reply may be shorter than requested */
+	  if (!DBG_MEMCPY(tmp, addr, tlen))
+	    break;
+	  put_stream_data (tmp, tlen);
+	  addr += tlen;
+	  len -= tlen;
+	}
+      return;
+    }
+#endif /* DBG_MEMCPY */
+  put_stream_data (addr, len);
+}
+#endif /* DBG_STREAM */
+
+static char put_packet_info (const char *src) FASTCALL {
+  unsigned n = reply_len;
+  tx_checksum = 0;
+  for (; n != 0; --n)
+    put_data (*src++);
+#ifdef DBG_STREAM
+  put_stream ();
+#endif
+#ifdef DBG_RLE
+  rle_flush ();
+#endif
+  return tx_checksum;
+}
+
+static void store_pc_sp (int pc_adj) FASTCALL {
+  byte *sp = get_reg_value (&_gdb_state[R_SP]);
+  byte *pc = get_reg_value (sp);
+  pc += pc_adj;
+  set_reg_value (&_gdb_state[R_PC], pc);
+  set_reg_value (&_gdb_state[R_SP], sp + REG_SIZE);
+}
+
+static char *hex2mem (byte *mem, char *buf, unsigned bytes);
+
+/* Command processors. Takes pointer to buffer (begins from command symbol),
    modifies buffer, returns: -1 - empty response (ignore), 0 - success,
    positive: error code. */
 
@@ -365,9 +1300,14 @@ static signed char process_question (char *p) FASTCALL {
   if (sig <= 0)
     sig = EX_SIGTRAP;
   p = byte2hex (p, (byte)sig);
-  p = format_reg_value(p, R_AF/REG_SIZE, &_gdb_state[R_AF]);
-  p = format_reg_value(p, R_SP/REG_SIZE, &_gdb_state[R_SP]);
-  p = format_reg_value(p, R_PC/REG_SIZE, &_gdb_state[R_PC]);
+  {
+    /* GDB does not read registers which are sent here */
+    unsigned mask = DBG_EXPEDITE;
+    byte i;
+    for (i = 0; mask != 0; ++i, mask >>= 1)
+      if (mask & 1)
+        p = format_reg_value (p, i, &_gdb_state[i*REG_SIZE]);
+  }
 #if defined(DBG_SWBREAK_PROC) || defined(DBG_HWBREAK) || defined(DBG_WWATCH) || defined(DBG_RWATCH) || defined(DBG_AWATCH)
   const char *reason;
   unsigned addr = 0;
@@ -422,16 +1362,472 @@ finish:
 #define STRING1(x) STRING2(x)
 #define STRING(x) STRING1(x)
 #if defined(DBG_MEMORY_MAP) || defined(DBG_FEATURE_STR)
-static void read_xml_document (char *buffer, unsigned offset, unsigned length, const char *doc);
+static void read_xml_document (char *buffer, unsigned offset, unsigned length,
+                               const char *doc, unsigned doc_sz);
 #endif
 
+#ifndef DBG_MIN_SIZE
+/* CRC-32 used by GDB: polynomial 0x04c11db7, not reflected, initial value
+   0xffffffff and no final xor */
+#ifdef DBG_CRC_TABLE
+static const unsigned long crc32_table[256] = {
+    0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9,
+    0x130476dc, 0x17c56b6b, 0x1a864db2, 0x1e475005,
+    0x2608edb8, 0x22c9f00f, 0x2f8ad6d6, 0x2b4bcb61,
+    0x350c9b64, 0x31cd86d3, 0x3c8ea00a, 0x384fbdbd,
+    0x4c11db70, 0x48d0c6c7, 0x4593e01e, 0x4152fda9,
+    0x5f15adac, 0x5bd4b01b, 0x569796c2, 0x52568b75,
+    0x6a1936c8, 0x6ed82b7f, 0x639b0da6, 0x675a1011,
+    0x791d4014, 0x7ddc5da3, 0x709f7b7a, 0x745e66cd,
+    0x9823b6e0, 0x9ce2ab57, 0x91a18d8e, 0x95609039,
+    0x8b27c03c, 0x8fe6dd8b, 0x82a5fb52, 0x8664e6e5,
+    0xbe2b5b58, 0xbaea46ef, 0xb7a96036, 0xb3687d81,
+    0xad2f2d84, 0xa9ee3033, 0xa4ad16ea, 0xa06c0b5d,
+    0xd4326d90, 0xd0f37027, 0xddb056fe, 0xd9714b49,
+    0xc7361b4c, 0xc3f706fb, 0xceb42022, 0xca753d95,
+    0xf23a8028, 0xf6fb9d9f, 0xfbb8bb46, 0xff79a6f1,
+    0xe13ef6f4, 0xe5ffeb43, 0xe8bccd9a, 0xec7dd02d,
+    0x34867077, 0x30476dc0, 0x3d044b19, 0x39c556ae,
+    0x278206ab, 0x23431b1c, 0x2e003dc5, 0x2ac12072,
+    0x128e9dcf, 0x164f8078, 0x1b0ca6a1, 0x1fcdbb16,
+    0x018aeb13, 0x054bf6a4, 0x0808d07d, 0x0cc9cdca,
+    0x7897ab07, 0x7c56b6b0, 0x71159069, 0x75d48dde,
+    0x6b93dddb, 0x6f52c06c, 0x6211e6b5, 0x66d0fb02,
+    0x5e9f46bf, 0x5a5e5b08, 0x571d7dd1, 0x53dc6066,
+    0x4d9b3063, 0x495a2dd4, 0x44190b0d, 0x40d816ba,
+    0xaca5c697, 0xa864db20, 0xa527fdf9, 0xa1e6e04e,
+    0xbfa1b04b, 0xbb60adfc, 0xb6238b25, 0xb2e29692,
+    0x8aad2b2f, 0x8e6c3698, 0x832f1041, 0x87ee0df6,
+    0x99a95df3, 0x9d684044, 0x902b669d, 0x94ea7b2a,
+    0xe0b41de7, 0xe4750050, 0xe9362689, 0xedf73b3e,
+    0xf3b06b3b, 0xf771768c, 0xfa325055, 0xfef34de2,
+    0xc6bcf05f, 0xc27dede8, 0xcf3ecb31, 0xcbffd686,
+    0xd5b88683, 0xd1799b34, 0xdc3abded, 0xd8fba05a,
+    0x690ce0ee, 0x6dcdfd59, 0x608edb80, 0x644fc637,
+    0x7a089632, 0x7ec98b85, 0x738aad5c, 0x774bb0eb,
+    0x4f040d56, 0x4bc510e1, 0x46863638, 0x42472b8f,
+    0x5c007b8a, 0x58c1663d, 0x558240e4, 0x51435d53,
+    0x251d3b9e, 0x21dc2629, 0x2c9f00f0, 0x285e1d47,
+    0x36194d42, 0x32d850f5, 0x3f9b762c, 0x3b5a6b9b,
+    0x0315d626, 0x07d4cb91, 0x0a97ed48, 0x0e56f0ff,
+    0x1011a0fa, 0x14d0bd4d, 0x19939b94, 0x1d528623,
+    0xf12f560e, 0xf5ee4bb9, 0xf8ad6d60, 0xfc6c70d7,
+    0xe22b20d2, 0xe6ea3d65, 0xeba91bbc, 0xef68060b,
+    0xd727bbb6, 0xd3e6a601, 0xdea580d8, 0xda649d6f,
+    0xc423cd6a, 0xc0e2d0dd, 0xcda1f604, 0xc960ebb3,
+    0xbd3e8d7e, 0xb9ff90c9, 0xb4bcb610, 0xb07daba7,
+    0xae3afba2, 0xaafbe615, 0xa7b8c0cc, 0xa379dd7b,
+    0x9b3660c6, 0x9ff77d71, 0x92b45ba8, 0x9675461f,
+    0x8832161a, 0x8cf30bad, 0x81b02d74, 0x857130c3,
+    0x5d8a9099, 0x594b8d2e, 0x5408abf7, 0x50c9b640,
+    0x4e8ee645, 0x4a4ffbf2, 0x470cdd2b, 0x43cdc09c,
+    0x7b827d21, 0x7f436096, 0x7200464f, 0x76c15bf8,
+    0x68860bfd, 0x6c47164a, 0x61043093, 0x65c52d24,
+    0x119b4be9, 0x155a565e, 0x18197087, 0x1cd86d30,
+    0x029f3d35, 0x065e2082, 0x0b1d065b, 0x0fdc1bec,
+    0x3793a651, 0x3352bbe6, 0x3e119d3f, 0x3ad08088,
+    0x2497d08d, 0x2056cd3a, 0x2d15ebe3, 0x29d4f654,
+    0xc5a92679, 0xc1683bce, 0xcc2b1d17, 0xc8ea00a0,
+    0xd6ad50a5, 0xd26c4d12, 0xdf2f6bcb, 0xdbee767c,
+    0xe3a1cbc1, 0xe760d676, 0xea23f0af, 0xeee2ed18,
+    0xf0a5bd1d, 0xf464a0aa, 0xf9278673, 0xfde69bc4,
+    0x89b8fd09, 0x8d79e0be, 0x803ac667, 0x84fbdbd0,
+    0x9abc8bd5, 0x9e7d9662, 0x933eb0bb, 0x97ffad0c,
+    0xafb010b1, 0xab710d06, 0xa6322bdf, 0xa2f33668,
+    0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4,
+};
+#else
+static const unsigned long crc32_table[16] = {
+    0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9,
+    0x130476dc, 0x17c56b6b, 0x1a864db2, 0x1e475005,
+    0x2608edb8, 0x22c9f00f, 0x2f8ad6d6, 0x2b4bcb61,
+    0x350c9b64, 0x31cd86d3, 0x3c8ea00a, 0x384fbdbd,
+};
+#endif /* DBG_CRC_TABLE */
+
+static unsigned long crc32 (unsigned long crc, const byte *mem, unsigned len) {
+  for (; len != 0; --len)
+    {
+#ifdef DBG_CRC_TABLE
+      crc = (crc << 8) ^ crc32_table[(byte)(crc >> 24) ^ *mem++];
+#else
+      crc = (crc << 4) ^ crc32_table[((byte)(crc >> 24) >> 4) ^ (*mem >> 4)];
+      crc = (crc << 4) ^ crc32_table[((byte)(crc >> 24) >> 4) ^ (*mem++ & 0x0f)];
+#endif
+    }
+  return crc;
+}
+
+static signed char process_crc (char *buffer) FASTCALL {
+    /* qCRC:AA..AA,LLLL  CRC-32 of LLLL bytes at address AA..AA */
+    char *p = &buffer[5];
+    const byte *addr = (void*)hex2int(&p);
+    if (*p++ != ',')
+        return 1;
+    unsigned len = (unsigned)hex2int(&p);
+    unsigned long crc = 0xffffffff;
+#ifdef DBG_MEMCPY
+    while (len != 0) {
+        byte tmp[16];
+        unsigned tlen = sizeof(tmp);
+        if (tlen > len)
+            tlen = len;
+        if (!DBG_MEMCPY(tmp, addr, tlen))
+            return 4;
+        crc = crc32 (crc, tmp, tlen);
+        addr += tlen;
+        len -= tlen;
+    }
+#else
+    crc = crc32 (crc, addr, len);
+#endif
+    p = buffer;
+    *p++ = 'C';
+    p = byte2hex (p, (byte)(crc >> 24));
+    p = byte2hex (p, (byte)(crc >> 16));
+    p = byte2hex (p, (byte)(crc >> 8));
+    p = byte2hex (p, (byte)crc);
+    *p = '\0';
+    return 0;
+}
+
+/* return non-zero if len bytes at addr are equal to pattern */
+static byte mem_match (const byte *addr, const byte *pattern, unsigned len) {
+#ifdef DBG_MEMCPY
+    byte tmp[16];
+    while (len != 0) {
+        unsigned tlen = sizeof(tmp);
+        if (tlen > len)
+            tlen = len;
+        if (!DBG_MEMCPY(tmp, addr, tlen) || memcmp (tmp, pattern, tlen) != 0)
+            return 0;
+        addr += tlen;
+        pattern += tlen;
+        len -= tlen;
+    }
+    return 1;
+#else
+    return memcmp (addr, pattern, len) == 0;
+#endif
+}
+
+static signed char process_search (char *buffer) FASTCALL {
+    /* qSearch:memory:AA..AA;LLLL;PP..PP  Find binary pattern PP..PP in
+       LLLL bytes at address AA..AA */
+    char *p = &buffer[15];
+    const byte *addr = (void*)hex2int(&p);
+    if (*p++ != ';')
+        return 1;
+    unsigned len = (unsigned)hex2int(&p);
+    if (*p++ != ';')
+        return 2;
+    const byte *pattern = (const byte*)p;
+    const unsigned plen = packet_len - (p - buffer);
+    if (plen == 0)
+        return 3;
+    if (len < plen)
+        goto not_found;
+    /* number of positions where pattern may start */
+    len -= plen - 1;
+    /* look for the first byte of the pattern, then compare the rest */
+    while (len != 0) {
+#ifdef DBG_MEMCPY
+        byte tmp[16];
+        unsigned tlen = sizeof(tmp);
+        if (tlen > len)
+            tlen = len;
+        if (!DBG_MEMCPY(tmp, addr, tlen))
+            return 4;
+        const byte *h = memchr (tmp, *pattern, tlen);
+        if (h != NULL)
+            tlen = h - tmp;
+        addr += tlen;
+        len -= tlen;
+        if (h == NULL)
+            continue;
+#else
+        const byte *h = memchr (addr, *pattern, len);
+        if (h == NULL)
+            break;
+        len -= h - addr;
+        addr = h;
+#endif
+        if (mem_match (addr, pattern, plen)) {
+            memcpy (buffer, "1,", 2);
+            p = int2hex (&buffer[2], (int)addr);
+            *p = '\0';
+            return 0;
+        }
+        ++addr;
+        --len;
+    }
+not_found:
+    memcpy (buffer, "0", 2);
+    return 0;
+}
+#endif /* DBG_MIN_SIZE */
+
+#ifdef DBG_MONITOR
+#ifdef DBG_PROFILER
+/* monitor prof: send the histogram as lines "address count" preceded by
+   "prof shift" line, address is the start of the sampled area */
+static void prof_dump (void) {
+  char text[42];
+  char *p;
+  word i;
+  memcpy (text, "prof ", 5);
+  p = byte2hex (&text[5], DBG_PROFILER_SHIFT);
+  *p++ = '\n';
+  for (i = 0; i < DBG_PROFILER_BUCKETS; ++i)
+    {
+      if (_gdb_prof_hist[i] == 0)
+        continue;
+      if (p + 10 > &text[sizeof(text) - 1])
+        {
+          *p = '\0';
+          put_console (text);
+          p = text;
+        }
+      p = int2hex (p, i << DBG_PROFILER_SHIFT);
+      *p++ = ' ';
+      p = int2hex (p, _gdb_prof_hist[i]);
+      *p++ = '\n';
+    }
+  *p = '\0';
+  put_console (text);
+}
+
+static signed char monitor_prof (const char *arg) FASTCALL {
+  if (*arg == '\0')
+    prof_dump ();
+  else if (strcmp (arg, " start") == 0)
+    {
+      _gdb_prof_on = 0;
+      memset (_gdb_prof_hist, 0, sizeof(_gdb_prof_hist));
+      _gdb_prof_on = 1;
+    }
+  else if (strcmp (arg, " stop") == 0)
+    _gdb_prof_on = 0;
+  else
+    return 2;
+  return 0;
+}
+#endif /* DBG_PROFILER */
+
+#ifdef DBG_STATS
+/* write decimal v and return pointer after it */
+static char *long2dec (char *p, unsigned long v) {
+  char digits[10];
+  byte n = 0;
+  do
+    {
+      digits[n++] = '0' + (byte)(v % 10);
+      v /= 10;
+    }
+  while (v != 0);
+  while (n != 0)
+    *p++ = digits[--n];
+  return p;
+}
+
+/* append " name value" to the line in text, send the line when it is full */
+static char *stats_item (char *text, char *p, const char *name,
+                         unsigned long v) {
+  if (p > &text[36])
+    {
+      *p++ = '\n';
+      *p = '\0';
+      put_console (text);
+      p = text;
+    }
+  *p++ = ' ';
+  while (*name)
+    *p++ = *name++;
+  *p++ = ' ';
+  return long2dec (p, v);
+}
+
+/* monitor stats: counters since start or "monitor stats reset" */
+static signed char monitor_stats (const char *arg) FASTCALL {
+  char text[64];
+  char name[2];
+  char *p = text;
+  byte i;
+  if (strcmp (arg, " reset") == 0)
+    {
+      memset (&stats, 0, sizeof(stats));
+      return 0;
+    }
+  if (*arg != '\0')
+    return 2;
+  p = stats_item (text, p, "packets in", stats.packets_in);
+  p = stats_item (text, p, "out", stats.packets_out);
+  p = stats_item (text, p, "bytes in", stats.bytes_in);
+  p = stats_item (text, p, "out", stats.bytes_out);
+  p = stats_item (text, p, "naks", stats.naks);
+  p = stats_item (text, p, "bad checksums", stats.bad_csum);
+  p = stats_item (text, p, "retransmits", stats.retransmits);
+  if (_gdb_ticks)
+    p = stats_item (text, p, "ticks", stats.ticks);
+  name[1] = '\0';
+  for (i = 0; i < sizeof(stats_names); ++i)
+    {
+      if (stats.commands[i] == 0)
+        continue;
+      name[0] = i < sizeof(stats_names) - 1 ? stats_names[i] : '*';
+      p = stats_item (text, p, name, stats.commands[i]);
+    }
+  *p++ = '\n';
+  *p = '\0';
+  put_console (text);
+  return 0;
+}
+#endif /* DBG_STATS */
+
+static signed char process_monitor (char *buffer) FASTCALL {
+  /* qRcmd,HH..HH  command given to "monitor", its output goes to
+     O packets before the reply */
+  const unsigned len = strlen (&buffer[6]) / 2;
+  hex2mem ((byte *)buffer, &buffer[6], len);
+  buffer[len] = '\0';
+#ifdef DBG_PROFILER
+  if (memcmp (buffer, "prof", 4) == 0)
+    {
+      signed char err = monitor_prof (&buffer[4]);
+      *buffer = '\0';
+      return err;
+    }
+#endif
+#ifdef DBG_STATS
+  if (memcmp (buffer, "stats", 5) == 0)
+    {
+      signed char err = monitor_stats (&buffer[5]);
+      *buffer = '\0';
+      return err;
+    }
+#endif
+  /* unknown command */
+  return 1;
+}
+#endif /* DBG_MONITOR */
+
+#ifdef DBG_LZ4
+/* add continuation bytes of LZ4 length which has all bits set */
+static const byte *lz4_len (const byte *p, unsigned *len) {
+  byte b;
+  if (*len != 15)
+    return p;
+  do
+    *len += b = *p++;
+  while (b == 255);
+  return p;
+}
+
+/* copy match of len bytes at offset before out to out, source and
+   destination overlap when offset is less than len */
+static signed char lz4_match (byte *out, unsigned offset, unsigned len) {
+#ifdef DBG_MEMCPY
+  byte tmp[16];
+  while (len != 0)
+    {
+      byte n = sizeof(tmp);
+      if (n > offset)
+        n = (byte)offset;
+      if (n > len)
+        n = (byte)len;
+      if (!DBG_MEMCPY(tmp, out - offset, n) || !DBG_MEMCPY(out, tmp, n))
+        return 4;
+      out += n;
+      len -= n;
+    }
+#else
+  const byte *src = out - offset;
+  do
+    *out++ = *src++;
+  while (--len != 0);
+#endif
+  return 0;
+}
+
+/* QLZ4:AA..AA,LLLL:data - write LLLL bytes at AA..AA decoded from LZ4 block
+   which extends to the end of the packet; qLZ4 replies the packet size */
+static signed char process_lz4 (char *buffer) FASTCALL {
+  const char *q = &buffer[5];
+  const byte *p;
+  const byte *end;
+  byte *out;
+  byte *start;
+  unsigned left;
+  unsigned len;
+  if (*buffer == 'q')
+    {
+      *int2hex (buffer, PACKET_SIZE) = '\0';
+      return 0;
+    }
+  start = out = (void*)hex2int(&q);
+  if (*q++ != ',')
+    return 1;
+  left = (unsigned)hex2int(&q);
+  if (*q++ != ':')
+    return 2;
+  p = (const byte *)q;
+  end = (const byte *)buffer + packet_len;
+  *buffer = '\0';
+  while (p < end)
+    {
+      const byte token = *p++;
+      /* literals */
+      len = token >> 4;
+      p = lz4_len (p, &len);
+      if (p > end || len > (unsigned)(end - p) || len > left)
+        return 3;
+      if (len != 0)
+        {
+#ifdef DBG_MEMCPY
+          if (!DBG_MEMCPY(out, p, len))
+            return 4;
+#else
+          memcpy (out, p, len);
+#endif
+          out += len;
+          p += len;
+          left -= len;
+        }
+      /* the last sequence has no match */
+      if (p == end)
+        break;
+      if (end - p < 2)
+        return 3;
+      const unsigned offset = p[0] | (p[1] << 8);
+      p += 2;
+      len = token & 15;
+      p = lz4_len (p, &len);
+      len += 4;
+      if (p > end || offset == 0 || offset > (unsigned)(out - start) || len > left)
+        return 3;
+      if (lz4_match (out, offset, len))
+        return 4;
+      out += len;
+      left -= len;
+    }
+  return left != 0 ? 3 : 0;
+}
+#endif /* DBG_LZ4 */
+
 static signed char process_q (char *buffer) FASTCALL {
     char *p;
     if (memcmp (buffer + 1, "Supported", 9) == 0) {
+#ifndef DBG_MIN_SIZE
+        /* new connection always starts with acknowledgements */
+        no_ack = 0;
+#endif
         memcpy (buffer, "PacketSize=", 11);
-        p = int2hex (&buffer[11], DBG_PACKET_SIZE);
+        p = int2hex (&buffer[11], REPORTED_PACKET_SIZE);
 #ifndef DBG_MIN_SIZE
-#ifdef DBG_SWBREAK_PROC
+#ifdef DBG_SWBREAK_TABLE
+        memcpy (p, ";swbreak+", 9);
+        p += 9;
+#elif defined(DBG_SWBREAK_PROC)
         if(DBG_SWBREAK_PROC) {
             memcpy (p, ";swbreak+", 9);
             p += 9;
@@ -452,6 +1848,16 @@ static signed char process_q (char *buffer) FASTCALL {
 #ifdef DBG_FEATURE_STR
         memcpy (p, ";qXfer:features:read+", 21);
         p += 21;
+#endif
+#ifdef DBG_COND
+        memcpy (p, ";ConditionalBreakpoints+", 24);
+        p += 24;
+#endif
+#ifndef DBG_MIN_SIZE
+        memcpy (p, ";binary-upload+", 15);
+        p += 15;
+        memcpy (p, ";QStartNoAckMode+", 17);
+        p += 17;
 #endif
         *p = '\0';
         return 0;
@@ -471,13 +1877,8 @@ static signed char process_q (char *buffer) FASTCALL {
         if (length == 0) {
         return 3;
         }
-        if (length > strlen(DBG_FEATURE_STR)) {
-        length = strlen(DBG_FEATURE_STR);
-        }
-        if (length > DBG_PACKET_SIZE) {
-        return 4;
-        }
-        read_xml_document (buffer, offset, length, DBG_FEATURE_STR);
+        read_xml_document (buffer, offset, length, DBG_FEATURE_STR,
+                           sizeof(DBG_FEATURE_STR) - 1);
         return 0;
     }
 #endif
@@ -493,156 +1894,1474 @@ static signed char process_q (char *buffer) FASTCALL {
         unsigned length = hex2int (&p);
         if (length == 0)
         return 3;
-        if (length > DBG_PACKET_SIZE)
-        return 4;
-        read_xml_document (buffer, offset, length, DBG_MEMORY_MAP);
+        read_xml_document (buffer, offset, length, DBG_MEMORY_MAP,
+                           sizeof(DBG_MEMORY_MAP) - 1);
         return 0;
     }
 #endif
+#ifdef DBG_TRACE
+    if (buffer[1] == 'T')
+        return process_trace (buffer);
+#endif
+#ifdef DBG_MONITOR
+    if (memcmp (buffer + 1, "Rcmd,", 5) == 0)
+        return process_monitor (buffer);
+#endif
+#ifdef DBG_LZ4
+    if (memcmp (buffer + 1, "LZ4", 3) == 0)
+        return process_lz4 (buffer);
+#endif
 #ifndef DBG_MIN_SIZE
+    if (memcmp (buffer + 1, "CRC:", 4) == 0)
+        return process_crc (buffer);
+    if (memcmp (buffer + 1, "Search:memory:", 14) == 0)
+        return process_search (buffer);
+    if (memcmp (buffer, "QStartNoAckMode", 16) == 0) {
+        /* acknowledgements stop after GDB acknowledges OK reply */
+        no_ack = 1;
+        *buffer = '\0';
+        return 0;
+    }
     if (memcmp (&buffer[1], "Attached", 9) == 0) {
         /* Just report that GDB attached to existing process
         if it is not applicable for you, then send patches */
         memcpy(buffer, "1", 2);
         return 0;
     }
-#endif /* DBG_MIN_SIZE */
-    *buffer = '\0';
-    return -1;
+#endif /* DBG_MIN_SIZE */
+    *buffer = '\0';
+    return -1;
+}
+
+static signed char process_g (char *buffer) FASTCALL {
+#ifdef DBG_TRACE
+  if (trace_frame != TRACE_NONE)
+    return trace_g (buffer);
+#endif
+#ifdef DBG_STREAM
+  *buffer = '\0';
+  stream_addr = _gdb_state;
+  stream_len = NUMREGBYTES;
+  stream_mode = STREAM_HEX;
+#else
+  mem2hex (buffer, _gdb_state, NUMREGBYTES);
+#endif
+  return 0;
+}
+
+static signed char process_G (char *buffer) FASTCALL {
+  hex2mem (_gdb_state, &buffer[1], NUMREGBYTES);
+  /* OK response */
+  *buffer = '\0';
+  return 0;
+}
+
+#ifndef DBG_MIN_SIZE
+/* pNN: read register NN */
+static signed char process_p (char *buffer) FASTCALL {
+  char *p = &buffer[1];
+  const unsigned n = (unsigned)hex2int (&p);
+  if (n >= NUMREGBYTES/REG_SIZE)
+    return 1;
+#ifdef DBG_TRACE
+  if (trace_frame != TRACE_NONE)
+    return trace_p (buffer, (byte)n);
+#endif
+  mem2hex (buffer, &_gdb_state[n*REG_SIZE], REG_SIZE);
+  return 0;
+}
+
+/* PNN=VVVV: write register NN */
+static signed char process_P (char *buffer) FASTCALL {
+  char *p = &buffer[1];
+  const unsigned n = (unsigned)hex2int (&p);
+  if (*p++ != '=' || n >= NUMREGBYTES/REG_SIZE)
+    return 1;
+  hex2mem (&_gdb_state[n*REG_SIZE], p, REG_SIZE);
+  *buffer = '\0';
+  return 0;
+}
+#endif /* DBG_MIN_SIZE */
+
+static signed char process_m (char *buffer) FASTCALL {
+    /* mAA..AA,LLLL  Read LLLL bytes at address AA..AA */
+    char *p = &buffer[1];
+    byte *addr = (void*)hex2int(&p);
+    if (*p++ != ',')
+        return 1;
+    unsigned len = (unsigned)hex2int(&p);
+    if (len == 0)
+        return 2;
+#ifdef DBG_TRACE
+    if (trace_frame != TRACE_NONE)
+        return trace_m (buffer, addr, len, 0);
+#endif
+#ifdef DBG_STREAM
+#ifdef DBG_MEMCPY
+    byte tmp;
+    if (!DBG_MEMCPY(&tmp, addr, 1))
+        return 4;
+#endif
+    *buffer = '\0';
+    stream_addr = addr;
+    stream_len = len;
+    stream_mode = STREAM_HEX | STREAM_TARGET;
+    return 0;
+#else /* DBG_STREAM */
+    if (len > PACKET_SIZE/2)
+        return 3;
+    p = buffer;
+#ifdef DBG_MEMCPY
+    do {
+        byte tmp[16];
+        unsigned tlen = sizeof(tmp);
+        if (tlen > len)
+            tlen = len;
+        if (!DBG_MEMCPY(tmp, addr, tlen))
+            return 4;
+        p = mem2hex (p, tmp, tlen);
+        addr += tlen;
+        len -= tlen;
+    }
+    while (len);
+#else
+    p = mem2hex (p, addr, len);
+#endif
+    return 0;
+#endif /* DBG_STREAM */
+}
+
+static signed char process_M (char *buffer) FASTCALL {
+    /* MAA..AA,LLLL: Write LLLL bytes at address AA.AA return OK */
+#ifdef DBG_STREAM_WRITE
+  /* payload has been written by get_packet */
+  *buffer = '\0';
+  return write_status;
+#else
+  char *p = &buffer[1];
+  byte *addr = (void*)hex2int(&p);
+  if (*p != ',')
+    return 1;
+  ++p;
+  unsigned len = (unsigned)hex2int(&p);
+  if (*p++ != ':')
+    return 2;
+  if (len == 0)
+    goto end;
+  if (len*2 + (p - buffer) > PACKET_SIZE)
+    return 3;
+#ifdef DBG_MEMCPY
+  do
+    {
+      byte tmp[16];
+      unsigned tlen = sizeof(tmp);
+      if (tlen > len)
+	tlen = len;
+      p = hex2mem (tmp, p, tlen);
+      if (!DBG_MEMCPY(addr, tmp, tlen))
+	return 4;
+      addr += tlen;
+	len -= tlen;
+    }
+  while (len);
+#else
+  hex2mem (addr, p, len);
+#endif
+end:
+  /* OK response */
+  *buffer = '\0';
+  return 0;
+#endif /* DBG_STREAM_WRITE */
+}
+
+#ifndef DBG_MIN_SIZE
+static signed char process_x (char *buffer) FASTCALL {
+    /* xAA..AA,LLLL  Read LLLL binary bytes at address AA..AA */
+    const char *p = &buffer[1];
+    byte *addr = (void*)hex2int(&p);
+    if (*p++ != ',')
+        return 1;
+    unsigned len = (unsigned)hex2int(&p);
+#ifdef DBG_TRACE
+    if (trace_frame != TRACE_NONE)
+        return trace_m (buffer, addr, len, 1);
+#endif
+    *buffer = 'b';
+#ifdef DBG_STREAM
+#ifdef DBG_MEMCPY
+    byte tmp;
+    if (len != 0 && !DBG_MEMCPY(&tmp, addr, 1))
+        return 4;
+#endif
+    stream_addr = addr;
+    stream_len = len;
+    stream_mode = STREAM_TARGET;
+    reply_len = 1;
+#else /* DBG_STREAM */
+    /* reply may contain fewer bytes than requested */
+    if (len > PACKET_SIZE - 1)
+        len = PACKET_SIZE - 1;
+    if (len != 0) {
+#ifdef DBG_MEMCPY
+        if (!DBG_MEMCPY(&buffer[1], addr, len))
+            return 4;
+#else
+        memcpy (&buffer[1], addr, len);
+#endif
+    }
+    reply_len = len + 1;
+#endif /* DBG_STREAM */
+    return 0;
+}
+
+static signed char process_X (char *buffer) FASTCALL {
+    /* XAA..AA,LLLL: Write LLLL binary bytes at address AA.AA return OK */
+#ifdef DBG_STREAM_WRITE
+  /* payload has been written by get_packet */
+  *buffer = '\0';
+  return write_status;
+#else
+  char *p = &buffer[1];
+  byte *addr = (void*)hex2int(&p);
+  if (*p != ',')
+    return 1;
+  ++p;
+  unsigned len = (unsigned)hex2int(&p);
+  if (*p++ != ':')
+    return 2;
+  if (len == 0)
+    goto end;
+  if (len + (p - buffer) > PACKET_SIZE)
+    return 3;
+#ifdef DBG_MEMCPY
+  if (!DBG_MEMCPY(addr, p, len))
+    return 4;
+#else
+  memcpy (addr, p, len);
+#endif
+end:
+  /* OK response */
+  *buffer = '\0';
+  return 0;
+#endif /* DBG_STREAM_WRITE */
+}
+#else /* DBG_MIN_SIZE */
+static signed char
+process_x (char *buffer) FASTCALL
+{
+  (void)buffer;
+  return -1;
+}
+
+static signed char
+process_X (char *buffer) FASTCALL
+{
+  (void)buffer;
+  return -1;
+}
+#endif /* DBG_MIN_SIZE */
+
+static signed char process_c (char *buffer) FASTCALL {
+    /* 'cAAAA' - Continue at address AAAA(optional) */
+  const char *p = &buffer[1];
+  if (*p != '\0')
+    {
+      void *addr = (void*)hex2int(&p);
+      set_reg_value (&_gdb_state[R_PC], addr);
+    }
+  resume ();
+  return 0;
+}
+
+#if defined(DBG_SOFTSTEP) || defined(DBG_SWBREAK_TABLE)
+#ifdef DBG_MEMCPY
+#define mem_copy(dest, src, n) (DBG_MEMCPY((dest), (src), (n)) != NULL)
+#else
+#define mem_copy(dest, src, n) (memcpy ((dest), (src), (n)), 1)
+#endif
+
+void gdb_swbreak (void) __naked;
+
+/* save memory at addr and write breakpoint there, return 0 if memory is
+   not writable */
+static byte break_insert (byte *addr, byte *save) {
+  byte code[BREAK_SIZE];
+  byte check[BREAK_SIZE];
+#ifdef DBG_SWBREAK_RST
+  code[0] = 0xc7 | DBG_SWBREAK_RST;
+#else
+  code[0] = 0xcd; /* call _gdb_swbreak */
+  code[1] = (word)gdb_swbreak & 0xff;
+  code[2] = (word)gdb_swbreak >> 8;
+#endif
+  if (!mem_copy (save, addr, BREAK_SIZE))
+    return 0;
+  if (!mem_copy (addr, code, BREAK_SIZE) ||
+      !mem_copy (check, addr, BREAK_SIZE) ||
+      memcmp (check, code, BREAK_SIZE) != 0)
+    {
+      (void)mem_copy (addr, save, BREAK_SIZE);
+      return 0;
+    }
+  return 1;
+}
+#endif /* DBG_SOFTSTEP || DBG_SWBREAK_TABLE */
+
+#ifdef DBG_SWBREAK_TABLE
+/* index of the first breakpoint at address not less than addr */
+static byte swbreak_find (const byte *addr) FASTCALL {
+  byte lo = 0;
+  byte hi = swbreak_count;
+  while (lo < hi)
+    {
+      const byte mid = (lo + hi) >> 1;
+      if (swbreak_table[mid].addr < addr)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+/* owners of the breakpoint at addr, 0 if there is none */
+static byte swbreak_owner (const byte *addr) FASTCALL {
+  const byte i = swbreak_find (addr);
+  if (i < swbreak_count && swbreak_table[i].addr == addr)
+    return swbreak_table[i].owner;
+  return 0;
+}
+
+/* take owner off breakpoint i, remove it if nobody else uses it */
+static void swbreak_release (byte i, byte owner) {
+  swbreak_table[i].owner &= ~owner;
+  if (swbreak_table[i].owner & SWBREAK_USED)
+    return;
+  --swbreak_count;
+  memmove (&swbreak_table[i], &swbreak_table[i + 1],
+           (swbreak_count - i) * sizeof(swbreak_table[0]));
+}
+
+/* add or remove breakpoint of owner, remove all breakpoints of owner if
+   addr is NULL */
+static int swbreak_update (byte owner, byte set, const byte *addr) {
+  byte i;
+  if (addr == NULL)
+    {
+      if (!set)
+        for (i = swbreak_count; i != 0; )
+          swbreak_release (--i, owner);
+      return 0;
+    }
+  i = swbreak_find (addr);
+  if (i < swbreak_count && swbreak_table[i].addr == addr)
+    {
+      if (set)
+        swbreak_table[i].owner |= owner;
+      else
+        swbreak_release (i, owner);
+      return 0;
+    }
+  if (!set)
+    return 0;
+  if (swbreak_count == DBG_SWBREAK_TABLE)
+    return 1;
+  memmove (&swbreak_table[i + 1], &swbreak_table[i],
+           (swbreak_count - i) * sizeof(swbreak_table[0]));
+  swbreak_table[i].addr = (byte *)addr;
+  swbreak_table[i].owner = owner;
+  ++swbreak_count;
+  return 0;
+}
+
+/* Z0 and z0, tracepoints at the same address are kept */
+static int swbreak_toggle (int set, void *addr) {
+  return swbreak_update (SWBREAK_GDB, set, addr);
+}
+
+/* write all breakpoints before the program is resumed, breakpoints in
+   unwritable memory are skipped */
+static void swbreak_patch (void) {
+  byte i;
+  for (i = 0; i < swbreak_count; ++i)
+    swbreak_table[i].inserted = !(swbreak_table[i].owner & SWBREAK_OVER) &&
+      break_insert (swbreak_table[i].addr, swbreak_table[i].save);
+}
+
+/* restore memory under all breakpoints in reverse order, so overlapping
+   breakpoints are restored properly */
+static void swbreak_unpatch (void) {
+  byte i = swbreak_count;
+  while (i != 0)
+    {
+      --i;
+      if (swbreak_table[i].inserted)
+        (void)mem_copy (swbreak_table[i].addr, swbreak_table[i].save, BREAK_SIZE);
+      swbreak_table[i].inserted = 0;
+    }
+}
+#endif /* DBG_SWBREAK_TABLE */
+
+#ifdef DBG_SOFTSTEP
+
+/* flags tested by conditions NZ/Z, NC/C, PO/PE and P/M */
+static const byte step_cc_flag[4] = { 0x40, 0x01, 0x04, 0x80 };
+
+/* return non-zero if condition cc of jp, call or ret is true */
+static byte step_cond (byte cc) FASTCALL {
+  const byte set = (_gdb_state[R_AF] & step_cc_flag[cc >> 1]) != 0;
+  return set == (cc & 1);
+}
+
+static word state_word (byte reg) FASTCALL {
+  return _gdb_state[reg] | ((word)_gdb_state[reg + 1] << 8);
+}
+
+/* decode instruction at pc and store address of the instruction which is
+   executed next to *next and address of the following instruction to *over,
+   they differ only for taken call and rst; return 0 if memory is not
+   readable or the next instruction is not known */
+static byte step_decode (const byte *pc, const byte **next, const byte **over) {
+  byte op[4];
+  const byte *o = op;
+  byte len = 1;
+  byte index = 0;
+  byte x, y, z;
+  word target = 0;
+  byte taken = 0;
+  byte call = 0;
+  if (!mem_copy (op, pc, sizeof(op)))
+    return 0;
+  switch (*o)
+    {
+    case 0xcb:
+      len = 2;
+      goto done;
+    case 0xed:
+      ++o;
+      ++len;
+      x = *o >> 6;
+      y = (*o >> 3) & 7;
+      z = *o & 7;
+#ifdef __SDCC_z180
+      /* in0 r,(n), out0 (n),r, tst n and tstio n */
+      if ((x == 0 && z <= 1) || *o == 0x64 || *o == 0x74)
+        ++len;
+#endif
+#ifdef __SDCC_z80n
+      /* test n, nextreg r,a and add rr,nn, push nn, nextreg r,n */
+      if (*o == 0x27 || *o == 0x92)
+        ++len;
+      else if ((*o >= 0x34 && *o <= 0x36) || *o == 0x8a || *o == 0x91)
+        len += 2;
+      /* jp (c) jumps to the port value read by the instruction itself,
+         a breakpoint planted by guess would let the program run away */
+      else if (*o == 0x98)
+        return 0;
+#endif
+      if (x == 1 && z == 3) /* ld (nn),rr and ld rr,(nn) */
+        len += 2;
+      else if (x == 1 && z == 5) /* retn and reti */
+        {
+          taken = 1;
+          goto ret;
+        }
+      /* repeated block instructions are stepped over as a whole */
+      goto done;
+    case 0xdd:
+    case 0xfd:
+      index = (*o == 0xdd) ? R_IX : R_IY;
+      ++o;
+      ++len;
+      if (*o == 0xdd || *o == 0xfd || *o == 0xed)
+        {
+          /* repeated prefix is executed as a separate instruction */
+          len = 1;
+          goto done;
+        }
+      if (*o == 0xcb)
+        {
+          len = 4;
+          goto done;
+        }
+    }
+  x = *o >> 6;
+  y = (*o >> 3) & 7;
+  z = *o & 7;
+  switch (x)
+    {
+    case 0:
+      switch (z)
+        {
+        case 0:
+          if (y < 2) /* nop, ex af,af' */
+            break;
+          ++len;
+          if (y == 2) /* djnz */
+            taken = (byte)(_gdb_state[R_BC + 1] - 1) != 0;
+          else if (y == 3) /* jr */
+            taken = 1;
+          else /* jr cc */
+            taken = step_cond (y - 4);
+          target = (word)pc + len + (signed char)o[1];
+          break;
+        case 1: /* ld rr,nn */
+          if (!(y & 1))
+            len += 2;
+          break;
+        case 2: /* ld (nn),hl, ld hl,(nn), ld (nn),a and ld a,(nn) */
+          if (y >= 4)
+            len += 2;
+          break;
+        case 4:
+        case 5: /* inc (ix+d) and dec (ix+d) */
+          if (index && y == 6)
+            ++len;
+          break;
+        case 6: /* ld r,n and ld (ix+d),n */
+          ++len;
+          if (index && y == 6)
+            ++len;
+          break;
+        }
+      break;
+    case 1: /* ld r,(ix+d) and ld (ix+d),r */
+      if (index && (y == 6 || z == 6) && *o != 0x76)
+        ++len;
+      break;
+    case 2: /* alu (ix+d) */
+      if (index && z == 6)
+        ++len;
+      break;
+    default:
+      switch (z)
+        {
+        case 0: /* ret cc */
+          taken = step_cond (y);
+          goto ret;
+        case 1:
+          if (y == 1) /* ret */
+            {
+              taken = 1;
+              goto ret;
+            }
+          if (y == 5) /* jp (hl), jp (ix) and jp (iy) */
+            {
+              taken = 1;
+              target = state_word (index ? index : R_HL);
+            }
+          break;
+        case 2: /* jp cc,nn */
+          len += 2;
+          taken = step_cond (y);
+          target = o[1] | ((word)o[2] << 8);
+          break;
+        case 3:
+          if (y == 0) /* jp nn */
+            {
+              len += 2;
+              taken = 1;
+              target = o[1] | ((word)o[2] << 8);
+            }
+          else if (y == 2 || y == 3) /* out (n),a and in a,(n) */
+            ++len;
+          break;
+        case 4: /* call cc,nn */
+          len += 2;
+          taken = step_cond (y);
+          call = 1;
+          target = o[1] | ((word)o[2] << 8);
+          break;
+        case 5: /* call nn */
+          if (y == 1)
+            {
+              len += 2;
+              taken = 1;
+              call = 1;
+              target = o[1] | ((word)o[2] << 8);
+            }
+          break;
+        case 6: /* alu n */
+          ++len;
+          break;
+        case 7: /* rst */
+          taken = 1;
+          call = 1;
+          target = y << 3;
+          break;
+        }
+    }
+  goto done;
+ret:
+  if (taken && !mem_copy (op, (const byte *)state_word (R_SP), 2))
+    return 0;
+  target = op[0] | ((word)op[1] << 8);
+done:
+  *over = pc + len;
+  *next = taken ? (const byte *)target : *over;
+  if (!call)
+    *over = *next;
+  return 1;
+}
+
+/* write temporary breakpoint to addr, return 0 if memory is not writable */
+static byte step_insert (byte *addr) FASTCALL {
+  if (!break_insert (addr, step_save))
+    return 0;
+  step_addr = addr;
+  step_set = 1;
+  return 1;
+}
+
+/* plant breakpoint at the instruction executed after one at PC */
+static signed char step_start (void) {
+  const byte *next;
+  const byte *over;
+  if (!step_decode (get_reg_value (&_gdb_state[R_PC]), &next, &over))
+    return 1;
+  /* call into ROM: stop after return */
+  if (!step_insert ((byte *)next) && (next == over || !step_insert ((byte *)over)))
+    return 2;
+  return 0;
+}
+
+#ifdef DBG_LIVE
+/* restore memory under the temporary breakpoint while a live packet is
+   handled or write it back */
+static void step_hide (byte hide) FASTCALL {
+  if (!step_set)
+    return;
+  if (hide)
+    (void)mem_copy (step_addr, step_save, BREAK_SIZE);
+  else
+    (void)break_insert (step_addr, step_save);
+}
+#endif /* DBG_LIVE */
+
+/* restore memory under the temporary breakpoint, report SIGTRAP if
+   it is hit or step again without stopping if PC is in the range */
+static void step_remove (void) {
+  const byte *pc = get_reg_value (&_gdb_state[R_PC]);
+  step_set = 0;
+  (void)mem_copy (step_addr, step_save, BREAK_SIZE);
+  if (sigval == EX_SWBREAK && pc == step_addr)
+    {
+      sigval = EX_SIGTRAP;
+      if (pc >= range_start && pc < range_end && step_start () == 0)
+        resume ();
+    }
+  range_start = range_end = NULL;
+}
+
+#if defined(DBG_COND) || defined(DBG_TRACE)
+/* insert or remove breakpoint of type EX_SWBREAK or EX_HWBREAK */
+static void break_toggle (signed char type, byte set, const byte *addr) {
+#ifdef DBG_HWBREAK
+  if (type == EX_HWBREAK)
+    {
+      DBG_HWBREAK (set, (void *)addr);
+      return;
+    }
+#endif
+#ifdef DBG_SWBREAK_TABLE
+  /* the breakpoint may be shared by GDB and a tracepoint, it is only
+     kept out of memory for the step */
+  {
+    const byte i = swbreak_find (addr);
+    if (i < swbreak_count && swbreak_table[i].addr == addr)
+      {
+        if (set)
+          swbreak_table[i].owner &= ~SWBREAK_OVER;
+        else
+          swbreak_table[i].owner |= SWBREAK_OVER;
+      }
+  }
+#elif defined(DBG_SWBREAK_PROC)
+  DBG_SWBREAK_PROC (set, (void *)addr);
+#endif
+  (void)type;
+}
+
+/* called on stub entry: insert back the breakpoint which has been
+   stepped over and continue if the step is done */
+static void over_check (void) {
+  if (over_addr == NULL)
+    return;
+  break_toggle (over_type, 1, over_addr);
+  over_addr = NULL;
+  if (sigval == EX_SIGTRAP)
+    resume ();
+}
+
+/* resume without stopping at the hit breakpoint: remove it, step and
+   insert it back on the next entry; return if it can not be stepped */
+static void step_over (void) {
+  const byte *pc = get_reg_value (&_gdb_state[R_PC]);
+  break_toggle (sigval, 0, pc);
+  if (step_start () == 0)
+    {
+      over_addr = pc;
+      over_type = sigval;
+      resume ();
+    }
+  break_toggle (sigval, 1, pc);
+}
+#endif /* DBG_COND || DBG_TRACE */
+
+#ifdef DBG_COND
+/* agent expression opcodes, see "Agent Expressions" in GDB manual */
+#define AX_ADD		0x02
+#define AX_SUB		0x03
+#define AX_MUL		0x04
+#define AX_DIV_SIGNED	0x05
+#define AX_DIV_UNSIGNED	0x06
+#define AX_REM_SIGNED	0x07
+#define AX_REM_UNSIGNED	0x08
+#define AX_LSH		0x09
+#define AX_RSH_SIGNED	0x0a
+#define AX_RSH_UNSIGNED	0x0b
+#define AX_TRACE	0x0c
+#define AX_TRACE_QUICK	0x0d
+#define AX_LOG_NOT	0x0e
+#define AX_BIT_AND	0x0f
+#define AX_BIT_OR	0x10
+#define AX_BIT_XOR	0x11
+#define AX_BIT_NOT	0x12
+#define AX_EQUAL	0x13
+#define AX_LESS_SIGNED	0x14
+#define AX_LESS_UNSIGNED 0x15
+#define AX_EXT		0x16
+#define AX_REF8		0x17
+#define AX_REF16	0x18
+#define AX_REF32	0x19
+#define AX_IF_GOTO	0x20
+#define AX_GOTO		0x21
+#define AX_CONST8	0x22
+#define AX_CONST16	0x23
+#define AX_CONST32	0x24
+#define AX_REG		0x26
+#define AX_END		0x27
+#define AX_DUP		0x28
+#define AX_POP		0x29
+#define AX_ZERO_EXT	0x2a
+#define AX_SWAP		0x2b
+#define AX_PICK		0x32
+#define AX_ROT		0x33
+
+/* evaluate agent expression of len bytes, return 0 if it is false and
+   1 if it is true or can not be evaluated */
+static byte ax_eval (const byte *code, byte len) {
+  long stack[DBG_AX_STACK];
+  byte n = 0; /* number of values on the stack */
+  byte pc = 0;
+  byte op;
+  long a, b;
+  while (pc < len)
+    {
+      op = code[pc++];
+      /* binary operators take b from the top and a below it */
+      if (op >= AX_ADD && op <= AX_LESS_UNSIGNED && op != AX_TRACE &&
+          op != AX_TRACE_QUICK && op != AX_LOG_NOT && op != AX_BIT_NOT)
+        {
+          if (n < 2)
+            return 1;
+          b = stack[--n];
+          a = stack[n - 1];
+          switch (op)
+            {
+            case AX_ADD: a += b; break;
+            case AX_SUB: a -= b; break;
+            case AX_MUL: a *= b; break;
+            case AX_DIV_SIGNED:
+            case AX_DIV_UNSIGNED:
+            case AX_REM_SIGNED:
+            case AX_REM_UNSIGNED:
+              if (b == 0)
+                return 1;
+              if (op == AX_DIV_SIGNED)
+                a /= b;
+              else if (op == AX_DIV_UNSIGNED)
+                a = (unsigned long)a / (unsigned long)b;
+              else if (op == AX_REM_SIGNED)
+                a %= b;
+              else
+                a = (unsigned long)a % (unsigned long)b;
+              break;
+            case AX_LSH: a <<= (byte)b; break;
+            case AX_RSH_SIGNED: a >>= (byte)b; break;
+            case AX_RSH_UNSIGNED: a = (unsigned long)a >> (byte)b; break;
+            case AX_BIT_AND: a &= b; break;
+            case AX_BIT_OR: a |= b; break;
+            case AX_BIT_XOR: a ^= b; break;
+            case AX_EQUAL: a = (a == b); break;
+            case AX_LESS_SIGNED: a = (a < b); break;
+            default: a = ((unsigned long)a < (unsigned long)b); break;
+            }
+          stack[n - 1] = a;
+          continue;
+        }
+      switch (op)
+        {
+        case AX_CONST8:
+        case AX_CONST16:
+        case AX_CONST32:
+        case AX_REG:
+          if (n == DBG_AX_STACK)
+            return 1;
+          b = op == AX_CONST32 ? 4 : (op == AX_CONST8 ? 1 : 2);
+          if (pc + b > len)
+            return 1;
+          /* operands are big endian */
+          for (a = 0; b != 0; --b)
+            a = (a << 8) | code[pc++];
+          if (op == AX_REG)
+            {
+              if (a >= NUMREGBYTES / REG_SIZE)
+                return 1;
+              a = state_word ((byte)a * REG_SIZE);
+            }
+          stack[n++] = a;
+          break;
+        case AX_REF8:
+        case AX_REF16:
+        case AX_REF32:
+          {
+            byte v[4];
+            if (n == 0)
+              return 1;
+            b = op == AX_REF32 ? 4 : (op == AX_REF8 ? 1 : 2);
+            if (!mem_copy (v, (const byte *)(word)stack[n - 1], (byte)b))
+              return 1;
+            /* memory is little endian */
+            for (a = 0; b != 0; )
+              a = (a << 8) | v[--b];
+            stack[n - 1] = a;
+          }
+          break;
+        case AX_EXT:
+        case AX_ZERO_EXT:
+          if (n == 0 || pc >= len)
+            return 1;
+          b = code[pc++];
+          if (b == 0) /* no sign bit to extend */
+            return 1;
+          if (b < 32)
+            {
+              unsigned long m = 1UL << (byte)(b - 1);
+              a = stack[n - 1] & ((m << 1) - 1);
+              if (op == AX_EXT)
+                a = (a ^ m) - m;
+              stack[n - 1] = a;
+            }
+          break;
+        case AX_LOG_NOT:
+        case AX_BIT_NOT:
+          if (n == 0)
+            return 1;
+          stack[n - 1] = op == AX_LOG_NOT ? !stack[n - 1] : ~stack[n - 1];
+          break;
+        case AX_IF_GOTO:
+        case AX_GOTO:
+          if (pc + 2 > len)
+            return 1;
+          b = ((word)code[pc] << 8) | code[pc + 1];
+          pc += 2;
+          if (op == AX_IF_GOTO)
+            {
+              if (n == 0)
+                return 1;
+              if (stack[--n] == 0)
+                break;
+            }
+          if (b >= len)
+            return 1;
+          pc = (byte)b;
+          break;
+        case AX_DUP:
+        case AX_PICK:
+          b = 0;
+          if (op == AX_PICK)
+            {
+              if (pc >= len)
+                return 1;
+              b = code[pc++];
+            }
+          if (n <= b || n == DBG_AX_STACK)
+            return 1;
+          stack[n] = stack[n - 1 - (byte)b];
+          ++n;
+          break;
+        case AX_POP:
+          if (n == 0)
+            return 1;
+          --n;
+          break;
+        case AX_SWAP:
+          if (n < 2)
+            return 1;
+          a = stack[n - 1];
+          stack[n - 1] = stack[n - 2];
+          stack[n - 2] = a;
+          break;
+        case AX_ROT:
+          if (n < 3)
+            return 1;
+          a = stack[n - 3];
+          stack[n - 3] = stack[n - 2];
+          stack[n - 2] = stack[n - 1];
+          stack[n - 1] = a;
+          break;
+        case AX_END:
+          return n == 0 || stack[n - 1] != 0;
+        default: /* tracing, floating point and state variables */
+          return 1;
+        }
+    }
+  return 1;
 }
 
-static signed char process_g (char *buffer) FASTCALL {
-  mem2hex (buffer, _gdb_state, NUMREGBYTES);
+/* remember or forget conditions of breakpoint at addr, p points to the
+   list of ";Xlen,bytecode" items after the kind of the Z packet */
+static signed char cond_update (byte set, const byte *addr, const char *p) {
+  byte slot = DBG_COND_COUNT;
+  byte i;
+  for (i = 0; i < DBG_COND_COUNT; ++i)
+    {
+      if (cond_table[i].code[0] != 0 && cond_table[i].addr == addr)
+        {
+          /* conditions are replaced when the breakpoint is set again */
+          cond_table[i].code[0] = 0;
+          slot = i;
+        }
+      else if (slot == DBG_COND_COUNT && cond_table[i].code[0] == 0)
+        slot = i;
+    }
+  if (!set || *p != ';' || p[1] != 'X')
+    return 0;
+  if (slot == DBG_COND_COUNT)
+    return 5;
+  byte *code = cond_table[slot].code;
+  byte *d = code;
+  while (*p == ';' && p[1] == 'X')
+    {
+      p += 2;
+      unsigned len = (unsigned)hex2int(&p);
+      if (*p++ != ',' || len == 0 || len + 2 > (unsigned)(&code[DBG_COND_SIZE] - d))
+        {
+          code[0] = 0;
+          return 6;
+        }
+      *d++ = (byte)len;
+      p = hex2mem (d, (char *)p, len);
+      d += len;
+    }
+  *d = 0;
+  cond_table[slot].addr = addr;
   return 0;
 }
 
-static signed char process_G (char *buffer) FASTCALL {
-  hex2mem (_gdb_state, &buffer[1], NUMREGBYTES);
-  /* OK response */
-  *buffer = '\0';
-  return 0;
+/* called on stub entry: resume silently if conditions of the hit breakpoint
+   are false, stepping over it first */
+static void cond_check (void) {
+  const byte *pc = get_reg_value (&_gdb_state[R_PC]);
+  const byte *code;
+  byte i;
+  if (sigval != EX_SWBREAK && sigval != EX_HWBREAK)
+    return;
+  for (i = 0; i < DBG_COND_COUNT; ++i)
+    if (cond_table[i].code[0] != 0 && cond_table[i].addr == pc)
+      break;
+  if (i == DBG_COND_COUNT)
+    return;
+  /* breakpoint stops if any of its conditions is true */
+  for (code = cond_table[i].code; *code != 0; code += *code + 1)
+    if (ax_eval (code + 1, *code))
+      return;
+  step_over ();
+}
+#endif /* DBG_COND */
+
+#ifdef DBG_TRACE
+#define TRACE_NOTRUN	0
+#define TRACE_STOP	1
+#define TRACE_FULL	2
+#define TRACE_PASSCOUNT	3
+
+struct trace_header {
+  word size;
+  word number;
+};
+
+struct trace_block {
+  const byte *addr;
+  word len;
+};
+
+static word trace_pos (word pos) FASTCALL {
+  return pos >= DBG_TRACE_BUFFER ? pos - DBG_TRACE_BUFFER : pos;
 }
 
-static signed char process_m (char *buffer) FASTCALL {
-    /* mAA..AA,LLLL  Read LLLL bytes at address AA..AA */
-    char *p = &buffer[1];
-    byte *addr = (void*)hex2int(&p);
-    if (*p++ != ',')
-        return 1;
-    unsigned len = (unsigned)hex2int(&p);
-    if (len == 0)
-        return 2;
-    if (len > DBG_PACKET_SIZE/2)
-        return 3;
-    p = buffer;
-#ifdef DBG_MEMCPY
-    do {
-        byte tmp[16];
-        unsigned tlen = sizeof(tmp);
-        if (tlen > len)
-            tlen = len;
-        if (!DBG_MEMCPY(tmp, addr, tlen))
-            return 4;
-        p = mem2hex (p, tmp, tlen);
-        addr += tlen;
-        len -= tlen;
+/* copy len bytes at pos of the ring buffer to dst */
+static void trace_copy (void *dst, word pos, word len) {
+  word n = DBG_TRACE_BUFFER - pos;
+  if (n > len)
+    n = len;
+  memcpy (dst, &trace_buf[pos], n);
+  memcpy ((byte *)dst + n, trace_buf, len - n);
+}
+
+/* copy len bytes from src to pos of the ring buffer, src is in memory
+   of the program if target is set; return 0 if it is not readable */
+static byte trace_put (word pos, const void *src, word len, byte target) {
+  word n = DBG_TRACE_BUFFER - pos;
+  if (n > len)
+    n = len;
+  if (!target)
+    {
+      memcpy (&trace_buf[pos], src, n);
+      memcpy (trace_buf, (const byte *)src + n, len - n);
+      return 1;
     }
-    while (len);
-#else
-    p = mem2hex (p, addr, len);
-#endif
+  if (!mem_copy (&trace_buf[pos], src, n))
     return 0;
+  return n == len || mem_copy (trace_buf, (const byte *)src + n, len - n);
 }
 
-static signed char process_M (char *buffer) FASTCALL {
-    /* MAA..AA,LLLL: Write LLLL bytes at address AA.AA return OK */
-  char *p = &buffer[1];
-  byte *addr = (void*)hex2int(&p);
-  if (*p != ',')
-    return 1;
-  ++p;
-  unsigned len = (unsigned)hex2int(&p);
-  if (*p++ != ':')
-    return 2;
-  if (len == 0)
-    goto end;
-  if (len*2 + (p - buffer) > DBG_PACKET_SIZE)
-    return 3;
-#ifdef DBG_MEMCPY
-  do
+/* remove tracepoints from the program */
+static void trace_stop (byte reason, word tp) {
+  byte i;
+  if (!trace_running)
+    return;
+  trace_running = 0;
+  trace_reason = reason;
+  trace_reason_tp = tp;
+  for (i = 0; i < trace_count; ++i)
+    if (trace_table[i].enabled)
+      swbreak_update (SWBREAK_TRACE, 0, trace_table[i].addr);
+}
+
+/* store frame of tracepoint i to the buffer, the oldest frames are
+   discarded to free space in circular mode */
+static void trace_collect (byte i) FASTCALL {
+  struct trace_header h;
+  struct trace_block b;
+  word size = sizeof(h) + NUMREGBYTES;
+  word start;
+  word pos;
+  byte k;
+  for (k = 0; k < trace_table[i].mem_count; ++k)
+    size += sizeof(b) + trace_table[i].mem[k].len;
+  while (DBG_TRACE_BUFFER - trace_used < size)
     {
-      byte tmp[16];
-      unsigned tlen = sizeof(tmp);
-      if (tlen > len)
-	tlen = len;
-      p = hex2mem (tmp, p, tlen);
-      if (!DBG_MEMCPY(addr, tmp, tlen))
-	return 4;
-      addr += tlen;
-	len -= tlen;
+      if (!trace_circular || trace_frames == 0)
+        {
+          trace_stop (TRACE_FULL, 0);
+          return;
+        }
+      trace_copy (&h, trace_head, sizeof(h));
+      trace_head = trace_pos (trace_head + h.size);
+      trace_used -= h.size;
+      --trace_frames;
     }
-  while (len);
-#else
-  hex2mem (addr, p, len);
-#endif
-end:
-  /* OK response */
-  *buffer = '\0';
-  return 0;
+  start = trace_pos (trace_head + trace_used);
+  pos = trace_pos (start + sizeof(h));
+  trace_put (pos, _gdb_state, NUMREGBYTES, 0);
+  size = sizeof(h) + NUMREGBYTES;
+  for (k = 0; k < trace_table[i].mem_count; ++k)
+    {
+      const byte reg = trace_table[i].mem[k].reg;
+      word addr = trace_table[i].mem[k].offset;
+      if (reg != 0xff)
+        addr += state_word (reg * REG_SIZE);
+      b.addr = (const byte *)addr;
+      b.len = trace_table[i].mem[k].len;
+      /* unreadable block is not stored */
+      if (!trace_put (trace_pos (start + size + sizeof(b)), b.addr, b.len, 1))
+        continue;
+      trace_put (trace_pos (start + size), &b, sizeof(b), 0);
+      size += sizeof(b) + b.len;
+    }
+  h.size = size;
+  h.number = trace_table[i].number;
+  trace_put (start, &h, sizeof(h), 0);
+  trace_used += size;
+  ++trace_frames;
+  ++trace_created;
 }
 
-#ifndef DBG_MIN_SIZE
-static signed char process_X (char *buffer) FASTCALL {
-    /* XAA..AA,LLLL: Write LLLL binary bytes at address AA.AA return OK */
-  char *p = &buffer[1];
-  byte *addr = (void*)hex2int(&p);
-  if (*p != ',')
+/* called on stub entry: collect frame if a tracepoint is hit and
+   continue without stopping */
+static void trace_check (void) {
+  const byte *pc = get_reg_value (&_gdb_state[R_PC]);
+  byte i;
+  if (!trace_running || sigval != EX_SWBREAK)
+    return;
+  for (i = 0; i < trace_count; ++i)
+    if (trace_table[i].enabled && trace_table[i].addr == pc)
+      break;
+  if (i == trace_count)
+    return;
+  trace_collect (i);
+  if (++trace_table[i].hits == trace_table[i].pass && trace_table[i].pass != 0)
+    trace_stop (TRACE_PASSCOUNT, trace_table[i].number);
+  /* breakpoint of GDB at the same address stops the program */
+  if (swbreak_owner (pc) & SWBREAK_GDB)
+    return;
+  /* stopped tracing has removed the breakpoint already */
+  if (!trace_running)
+    resume ();
+  step_over ();
+}
+
+/* QTDP:n:addr:E:step:pass[-] defines tracepoint n,
+   QTDP:-n:addr:action[-] adds action to it */
+static signed char trace_define (const char *p) FASTCALL {
+  const byte more = *p == '-';
+  word number;
+  const byte *addr;
+  byte i;
+  if (more)
+    ++p;
+  number = (word)hex2int (&p);
+  if (*p++ != ':')
     return 1;
-  ++p;
-  unsigned len = (unsigned)hex2int(&p);
+  addr = (const byte *)hex2int (&p);
   if (*p++ != ':')
+    return 1;
+  for (i = 0; i < trace_count; ++i)
+    if (trace_table[i].number == number && trace_table[i].addr == addr)
+      break;
+  if (!more)
+    {
+      if (i == trace_count)
+        {
+          if (trace_count == DBG_TRACE_COUNT)
+            return 5;
+          ++trace_count;
+        }
+      trace_table[i].addr = addr;
+      trace_table[i].number = number;
+      trace_table[i].enabled = *p == 'E';
+      trace_table[i].mem_count = 0;
+      p += 2;
+      /* while-stepping is not supported, step count is ignored */
+      hex2int (&p);
+      if (*p++ != ':')
+        return 1;
+      trace_table[i].pass = (word)hex2int (&p);
+      trace_table[i].hits = 0;
+      /* conditions and fast tracepoints are ignored */
+      return 0;
+    }
+  if (i == trace_count)
     return 2;
-  if (len == 0)
-    goto end;
-  if (len + (p - buffer) > DBG_PACKET_SIZE)
+  /* registers are always collected, expressions are not supported */
+  if (*p++ != 'M')
+    return 0;
+  const byte k = trace_table[i].mem_count;
+  if (k == DBG_TRACE_MEM)
+    return 6;
+  /* base register is -1 for absolute address */
+  const byte reg = (byte)hex2int (&p);
+  if (*p++ != ',')
+    return 1;
+  trace_table[i].mem[k].offset = (word)hex2int (&p);
+  if (*p++ != ',')
+    return 1;
+  const word len = (word)hex2int (&p);
+  if (reg != 0xff && reg >= NUMREGBYTES / REG_SIZE)
     return 3;
-#ifdef DBG_MEMCPY
-  if (!DBG_MEMCPY(addr, p, len))
+  if (len > DBG_TRACE_BUFFER - sizeof(struct trace_header) - NUMREGBYTES -
+      sizeof(struct trace_block))
     return 4;
-#else
-  memcpy (addr, p, len);
-#endif
-end:
-  /* OK response */
-  *buffer = '\0';
+  trace_table[i].mem[k].reg = reg;
+  trace_table[i].mem[k].len = len;
+  trace_table[i].mem_count = k + 1;
   return 0;
 }
-#else /* DBG_MIN_SIZE */
+
+static signed char trace_start (void) {
+  byte i;
+  trace_stop (TRACE_STOP, 0);
+  trace_head = trace_used = trace_frames = trace_created = 0;
+  trace_frame = TRACE_NONE;
+  for (i = 0; i < trace_count; ++i)
+    {
+      trace_table[i].hits = 0;
+      if (trace_table[i].enabled &&
+          swbreak_update (SWBREAK_TRACE, 1, trace_table[i].addr))
+        {
+          /* remove already inserted tracepoints */
+          while (i != 0)
+            if (trace_table[--i].enabled)
+              swbreak_update (SWBREAK_TRACE, 0, trace_table[i].addr);
+          return 2;
+        }
+    }
+  trace_running = 1;
+  return 0;
+}
+
+static const char * const trace_reasons[] = {
+  "tnotrun", "tstop", "tfull", "tpasscount"
+};
+
+static char *trace_field (char *p, const char *name, word v) {
+  const byte n = strlen (name);
+  *p++ = ';';
+  memcpy (p, name, n);
+  p += n;
+  *p++ = ':';
+  return int2hex (p, v);
+}
+
+static signed char trace_status (char *buffer) FASTCALL {
+  char *p;
+  buffer[0] = 'T';
+  buffer[1] = '0' + trace_running;
+  p = trace_field (&buffer[2], trace_reasons[trace_reason], trace_reason_tp);
+  p = trace_field (p, "tframes", trace_frames);
+  p = trace_field (p, "tcreated", trace_created);
+  p = trace_field (p, "tfree", DBG_TRACE_BUFFER - trace_used);
+  p = trace_field (p, "tsize", DBG_TRACE_BUFFER);
+  p = trace_field (p, "circular", trace_circular);
+  *p = '\0';
+  return 0;
+}
+
+/* QTFrame:n, QTFrame:pc:addr, QTFrame:tdp:n, QTFrame:range:start:end and
+   QTFrame:outside:start:end select a frame, searches start after the
+   selected one */
+static signed char trace_find (char *buffer, const char *p) {
+  struct trace_header h;
+  byte kind = 0;
+  word n = 0;
+  const byte *lo = NULL;
+  const byte *hi = NULL;
+  word pos = trace_head;
+  word i;
+  char *d;
+  if (memcmp (p, "pc:", 3) == 0)
+    {
+      p += 3;
+      lo = hi = (const byte *)hex2int (&p);
+      kind = 1;
+    }
+  else if (memcmp (p, "tdp:", 4) == 0)
+    {
+      p += 4;
+      n = (word)hex2int (&p);
+      kind = 2;
+    }
+  else if (memcmp (p, "range:", 6) == 0 || memcmp (p, "outside:", 8) == 0)
+    {
+      kind = *p == 'r' ? 1 : 3;
+      p = strchr (p, ':') + 1;
+      lo = (const byte *)hex2int (&p);
+      if (*p++ != ':')
+        return 1;
+      hi = (const byte *)hex2int (&p);
+    }
+  else
+    n = (word)hex2int (&p);
+  for (i = 0; i < trace_frames; ++i, pos = trace_pos (pos + h.size))
+    {
+      trace_copy (&h, pos, sizeof(h));
+      if (kind == 0)
+        {
+          if (i != n)
+            continue;
+        }
+      else if (trace_frame != TRACE_NONE && i <= trace_frame)
+        continue;
+      else if (kind == 2)
+        {
+          if (h.number != n)
+            continue;
+        }
+      else
+        {
+          byte r[REG_SIZE];
+          const byte *pc;
+          trace_copy (r, trace_pos (pos + sizeof(h) + R_PC), REG_SIZE);
+          pc = get_reg_value (r);
+          if ((pc >= lo && pc <= hi) != (kind == 1))
+            continue;
+        }
+      trace_frame = i;
+      trace_frame_pos = pos;
+      buffer[0] = 'F';
+      d = int2hex (&buffer[1], i);
+      *d++ = 'T';
+      d = int2hex (d, h.number);
+      *d = '\0';
+      return 0;
+    }
+  trace_frame = TRACE_NONE;
+  memcpy (buffer, "F-1", 4);
+  return 0;
+}
+
+static signed char trace_g (char *buffer) FASTCALL {
+  byte regs[NUMREGBYTES];
+  trace_copy (regs, trace_pos (trace_frame_pos + sizeof(struct trace_header)),
+              NUMREGBYTES);
+  mem2hex (buffer, regs, NUMREGBYTES);
+  return 0;
+}
+
+static signed char trace_p (char *buffer, byte n) {
+  byte reg[REG_SIZE];
+  trace_copy (reg, trace_pos (trace_frame_pos + sizeof(struct trace_header) +
+                              n*REG_SIZE), REG_SIZE);
+  mem2hex (buffer, reg, REG_SIZE);
+  return 0;
+}
+
+/* reply to m or x packet from the selected frame: bytes from addr up to
+   the end of collected block which contains it */
 static signed char
-process_X (char *buffer) FASTCALL
-{
-  (void)buffer;
+trace_m (char *buffer, const byte *addr, unsigned len, byte binary) {
+  struct trace_header h;
+  struct trace_block b;
+  word pos = sizeof(h) + NUMREGBYTES;
+  word n;
+  if (binary)
+    {
+      *buffer = 'b';
+      reply_len = 1;
+      if (len == 0)
+        return 0;
+      if (len > PACKET_SIZE - 1)
+        len = PACKET_SIZE - 1;
+    }
+  else if (len > PACKET_SIZE/2)
+    len = PACKET_SIZE/2;
+  trace_copy (&h, trace_frame_pos, sizeof(h));
+  for (; pos < h.size; pos += b.len)
+    {
+      trace_copy (&b, trace_pos (trace_frame_pos + pos), sizeof(b));
+      pos += sizeof(b);
+      n = (word)(addr - b.addr);
+      if (addr < b.addr || n >= b.len)
+        continue;
+      pos = trace_pos (trace_frame_pos + pos + n);
+      n = b.len - n;
+      if (n > len)
+        n = len;
+      if (binary)
+        {
+          trace_copy (&buffer[1], pos, n);
+          reply_len = n + 1;
+        }
+      else
+        {
+          /* hex digits are written over the bytes already converted */
+          trace_copy (&buffer[len], pos, n);
+          mem2hex (buffer, (byte *)&buffer[len], n);
+        }
+      return 0;
+    }
+  /* memory is not collected */
+  return 4;
+}
+
+static signed char process_trace (char *buffer) FASTCALL {
+  const char *p = &buffer[2];
+  byte i;
+  if (*buffer == 'q')
+    {
+      if (strcmp (p, "Status") == 0)
+        return trace_status (buffer);
+      if (memcmp (p, "P:", 2) == 0)
+        {
+          /* qTP:n:addr  Hit count of tracepoint */
+          p += 2;
+          const word number = (word)hex2int (&p);
+          if (*p++ != ':')
+            return 1;
+          const byte *addr = (const byte *)hex2int (&p);
+          for (i = 0; i < trace_count; ++i)
+            if (trace_table[i].number == number && trace_table[i].addr == addr)
+              {
+                buffer[0] = 'V';
+                memcpy (int2hex (&buffer[1], trace_table[i].hits), ":0", 3);
+                return 0;
+              }
+          return 1;
+        }
+    }
+  else if (strcmp (p, "init") == 0)
+    {
+      trace_stop (TRACE_NOTRUN, 0);
+      trace_count = 0;
+      trace_reason = TRACE_NOTRUN;
+      trace_head = trace_used = trace_frames = trace_created = 0;
+      trace_frame = TRACE_NONE;
+      goto ok;
+    }
+  else if (memcmp (p, "DP:", 3) == 0)
+    {
+      i = trace_define (p + 3);
+      if (i)
+        return i;
+      goto ok;
+    }
+  else if (strcmp (p, "Start") == 0)
+    {
+      i = trace_start ();
+      if (i)
+        return i;
+      goto ok;
+    }
+  else if (strcmp (p, "Stop") == 0)
+    {
+      trace_stop (TRACE_STOP, 0);
+      goto ok;
+    }
+  else if (memcmp (p, "Frame:", 6) == 0)
+    return trace_find (buffer, p + 6);
+  else if (memcmp (p, "Buffer:circular:", 16) == 0)
+    {
+      trace_circular = buffer[18] != '0';
+      goto ok;
+    }
+  else if (memcmp (p, "ro:", 3) == 0 || memcmp (p, "DPsrc:", 6) == 0 ||
+           memcmp (p, "Disconnected:", 13) == 0 || memcmp (p, "Notes:", 6) == 0)
+    /* sections, source strings and notes are not needed by the stub */
+    goto ok;
+  *buffer = '\0';
   return -1;
+ok:
+  *buffer = '\0';
+  return 0;
 }
-#endif /* DBG_MIN_SIZE */
+#endif /* DBG_TRACE */
 
-static signed char process_c (char *buffer) FASTCALL {
-    /* 'cAAAA' - Continue at address AAAA(optional) */
+static signed char soft_step (char *buffer) FASTCALL {
   const char *p = &buffer[1];
+  signed char err;
   if (*p != '\0')
     {
       void *addr = (void*)hex2int(&p);
       set_reg_value (&_gdb_state[R_PC], addr);
     }
-  _gdb_rest_cpu_state ();
+  err = step_start ();
+  if (err)
+    return err;
+  resume ();
   return 0;
 }
+#endif /* DBG_SOFTSTEP */
 
 static signed char process_s (char *buffer) FASTCALL {
   /* 'sAAAA' - Step at address AAAA(optional) */
   #if defined(DBG_TOGGLESTEP) && defined(DBG_SWBREAK)
   if(!DBG_TOGGLESTEP) {
+#ifdef DBG_SOFTSTEP
+    return soft_step (buffer);
+#else
     return -1;
+#endif
   }
   int err = DBG_TOGGLESTEP(1);
   if(err) {
@@ -654,8 +3373,10 @@ static signed char process_s (char *buffer) FASTCALL {
       void *addr = (void*)hex2int(&p);
       set_reg_value (&_gdb_state[R_PC], addr);
     }
-  _gdb_rest_cpu_state ();
+  resume ();
   return 0;
+  #elif defined(DBG_SOFTSTEP)
+  return soft_step (buffer);
   #else
   return -1;
   #endif
@@ -663,12 +3384,18 @@ static signed char process_s (char *buffer) FASTCALL {
 
 static signed char process_D (char *buffer) FASTCALL {
     /* 'D' - detach the program: continue execution */
+    (void)buffer;
+#ifndef DBG_SWBREAK_TABLE
     if(!DBG_SWBREAK_PROC) {
         return -1;
     }
+#endif
 
     DBG_SWBREAK_PROC(0, NULL);
-    _gdb_rest_cpu_state ();
+#ifndef DBG_MIN_SIZE
+    no_ack = 0;
+#endif
+    resume ();
     return 0;
 }
 
@@ -676,25 +3403,142 @@ static signed char
 process_k (char *buffer) FASTCALL {
     /* 'k' - Kill the program */
   set_reg_value (&_gdb_state[R_PC], 0);
-  _gdb_rest_cpu_state ();
+#ifndef DBG_MIN_SIZE
+  no_ack = 0;
+#endif
+  resume ();
   (void)buffer;
   return 0;
 }
 
+#ifdef DBG_FLASH
+/* program written part of the collected block */
+static signed char flash_flush (void) {
+  signed char ret = 0;
+  if (flash_lo < flash_hi)
+    {
+      if (!_gdb_flash_program ||
+          _gdb_flash_program (flash_addr + flash_lo, &flash_buf[flash_lo],
+                              flash_hi - flash_lo))
+        ret = 4;
+    }
+  flash_lo = flash_hi = 0;
+  return ret;
+}
+
+/* collect data to blocks of DBG_FLASH bytes, so every block is programmed
+   once however GDB splits the data; bytes not written in the middle of a
+   block are left 0xff, which does not change erased flash */
+static signed char flash_write (byte *addr, const byte *data, unsigned len) {
+  while (len != 0)
+    {
+      const unsigned offset = (unsigned)addr & (DBG_FLASH - 1);
+      byte *block = addr - offset;
+      unsigned n = DBG_FLASH - offset;
+      if (n > len)
+        n = len;
+      if (block != flash_addr || flash_lo == flash_hi)
+        {
+          if (flash_flush ())
+            return 4;
+          memset (flash_buf, 0xff, DBG_FLASH);
+          flash_addr = block;
+          flash_lo = offset;
+          flash_hi = offset;
+        }
+      memcpy (&flash_buf[offset], data, n);
+      if (offset < flash_lo)
+        flash_lo = offset;
+      if (offset + n > flash_hi)
+        flash_hi = offset + n;
+      addr += n;
+      data += n;
+      len -= n;
+    }
+  return 0;
+}
+
+/* vFlashErase:addr,length, vFlashWrite:addr:data and vFlashDone */
+static signed char process_flash (char *buffer) FASTCALL {
+  const char *p = &buffer[6];
+  byte *addr;
+  if (memcmp (p, "Done", 4) == 0)
+    {
+      *buffer = '\0';
+      return flash_flush ();
+    }
+  if (memcmp (p, "Write:", 6) == 0)
+    {
+      *buffer = '\0';
+      p += 6;
+      addr = (void*)hex2int(&p);
+      if (*p++ != ':')
+        return 1;
+      return flash_write (addr, (const byte *)p, packet_len - (p - buffer));
+    }
+  if (memcmp (p, "Erase:", 6) == 0)
+    {
+      p += 6;
+      addr = (void*)hex2int(&p);
+      if (*p++ != ',')
+        return 1;
+      *buffer = '\0';
+      /* keep order of writes and erases */
+      if (flash_flush ())
+        return 4;
+      if (!_gdb_flash_erase || _gdb_flash_erase (addr, (unsigned)hex2int(&p)))
+        return 4;
+      return 0;
+    }
+  return -1;
+}
+#endif /* DBG_FLASH */
+
 static signed char process_v (char *buffer) FASTCALL {
 #ifndef DBG_MIN_SIZE
+#ifdef DBG_FLASH
+  if (memcmp (&buffer[1], "Flash", 5) == 0)
+    return process_flash (buffer);
+#endif
   if (memcmp (&buffer[1], "Cont", 4) == 0)
     {
       if (buffer[5] == '?')
 	{
 	  /* result response will be "vCont;c;C"; C action must be
 	     supported too, because GDB reguires at lease both of them */
+#ifdef DBG_SOFTSTEP
+	  /* GDB uses vCont only if s and S are supported too */
+	  memcpy (&buffer[5], ";c;C;s;S;r", 11);
+#else
 	  memcpy (&buffer[5], ";c;C", 5);
+#endif
 	  return 0;
 	}
       buffer[0] = '\0';
-      if (buffer[5] == ';' && (buffer[6] == 'c' || buffer[6] == 'C'))
-	return -2; /* resume execution */
+      if (buffer[5] != ';')
+	return 1;
+      switch (buffer[6])
+	{
+	case 'c':
+	case 'C':
+	  return -2; /* resume execution */
+#ifdef DBG_SOFTSTEP
+	case 'r':
+	  {
+	    /* rAA..AA,BB..BB: step while PC is in [AA..AA, BB..BB) */
+	    const char *p = &buffer[7];
+	    range_start = (void*)hex2int(&p);
+	    if (*p++ != ',')
+	      return 2;
+	    range_end = (void*)hex2int(&p);
+	  }
+	  /* fall through */
+	case 's':
+	case 'S':
+	  buffer[1] = '\0';
+	  return soft_step (buffer);
+#endif
+	}
       return 1;
   }
 #endif /* DBG_MIN_SIZE */
@@ -716,18 +3560,32 @@ static signed char process_zZ (char *buffer) FASTCALL {
     switch (buffer[1]) {
 #ifdef DBG_SWBREAK_PROC
         case '0': /* sw break */
+#ifndef DBG_SWBREAK_TABLE
             if(!DBG_SWBREAK_PROC) {
                 return -1;
             }
+#endif
+#ifdef DBG_COND
+            if (DBG_SWBREAK_PROC(set, addr))
+                return 1;
+            return cond_update (set, addr, p);
+#else
             return DBG_SWBREAK_PROC(set, addr);
 #endif
+#endif
 #ifdef DBG_HWBREAK
         case '1': /* hw break */
             if(!DBG_HWBREAK) {
                 return -1;
             }
+#ifdef DBG_COND
+            if (DBG_HWBREAK(set, addr))
+                return 1;
+            return cond_update (set, addr, p);
+#else
             return DBG_HWBREAK(set, addr);
 #endif
+#endif
 #ifdef DBG_WWATCH
         case '2': /* write watch */
             return DBG_WWATCH(set, addr, kind);
@@ -748,6 +3606,12 @@ static signed char process_zZ (char *buffer) FASTCALL {
 }
 
 static signed char do_process (char *buffer) FASTCALL {
+#ifdef DBG_STATS
+    const char *name = strchr (stats_names, *buffer);
+    /* strchr finds the terminating '\0' of empty packet too */
+    ++stats.commands[name != NULL ? (unsigned)(name - stats_names) :
+                   sizeof(stats_names) - 1];
+#endif
     switch (*buffer) {
         case 's': return process_s(buffer);
         case '?': return process_question (buffer);
@@ -759,8 +3623,14 @@ static signed char do_process (char *buffer) FASTCALL {
         case 'c': return process_c (buffer);
         case 'D': return process_D (buffer);
         case 'g': return process_g (buffer);
+#ifndef DBG_MIN_SIZE
+        case 'p': return process_p (buffer);
+        case 'P': return process_P (buffer);
+#endif
         case 'm': return process_m (buffer);
+        case 'x': return process_x (buffer);
         case 'q': return process_q (buffer);
+        case 'Q': return process_q (buffer);
         case 'v': return process_v (buffer);
         case 'z': return process_zZ (buffer);
         default:  return -1; /* empty response */
@@ -770,7 +3640,14 @@ static signed char do_process (char *buffer) FASTCALL {
 }
 
 static char process (char *buffer) FASTCALL {
-  signed char err = do_process (buffer);
+  signed char err;
+  reply_len = 0;
+#ifdef DBG_STREAM
+  stream_len = 0;
+#endif
+  DBG_TICKS_MARK (DBG_TICKS_PROCESS);
+  err = do_process (buffer);
+  DBG_TICKS_MARK (DBG_TICKS_PROCESS_END);
   char *p = buffer;
   char ret = 1;
   if (err == -2)
@@ -778,6 +3655,13 @@ static char process (char *buffer) FASTCALL {
       ret = 0;
       err = 0;
     }
+  if (err != 0)
+    {
+#ifdef DBG_STREAM
+      stream_len = 0;
+#endif
+      reply_len = 0;
+    }
   if (err > 0)
     {
       *p++ = 'E';
@@ -788,14 +3672,27 @@ static char process (char *buffer) FASTCALL {
     {
       *p = '\0';
     }
+#ifdef DBG_STREAM
+  else if (*p == '\0' && stream_len == 0)
+#else
   else if (*p == '\0')
+#endif
     memcpy(p, "OK", 3);
+  if (reply_len == 0)
+    reply_len = strlen (buffer);
   return ret;
 }
 
 #if defined(DBG_MEMORY_MAP) || defined(DBG_FEATURE_STR)
-static void read_xml_document (char *buffer, unsigned offset, unsigned length, const char *doc) {
-    const unsigned doc_sz = strlen(doc);
+/* reply to qXfer read of length bytes at offset of doc, sizes of documents
+   are known at compile time */
+static void read_xml_document (char *buffer, unsigned offset, unsigned length,
+                               const char *doc, unsigned doc_sz) {
+#ifndef DBG_STREAM
+    if (length > PACKET_SIZE - 1) {
+        length = PACKET_SIZE - 1;
+    }
+#endif
     if (offset >= doc_sz) {
         buffer[0] = 'l';
         buffer[1] = '\0';
@@ -808,8 +3705,17 @@ static void read_xml_document (char *buffer, unsigned offset, unsigned length, c
     else {
         buffer[0] = 'm';
     }
+#ifdef DBG_STREAM
+    /* the document is sent as it is, a single reply may hold all of it */
+    buffer[1] = '\0';
+    reply_len = 1;
+    stream_addr = (const byte *)&doc[offset];
+    stream_len = length;
+    stream_mode = 0;
+#else
     memcpy (&buffer[1], &doc[offset], length);
     buffer[1+length] = '\0';
+#endif
 }
 #endif
 
@@ -820,10 +3726,10 @@ static char * format_reg_value (char *p, unsigned reg_num, const byte *value) {
     unsigned char i;
     d = byte2hex(d, reg_num);
     *d++ = ':';
-    value += REG_SIZE;
+    /* in target byte order, as in g packet */
     i = REG_SIZE;
     do {
-        d = byte2hex(d, *--value);
+        d = byte2hex(d, *value++);
     }
     while (--i != 0);
     *d++ = ';';
@@ -946,15 +3852,10 @@ void _gdb_save_cpu_state() __naked {
 void _gdb_rest_cpu_state() __naked {
   __asm
 #ifdef DBG_USE_TRAMPOLINE
-	ld	sp, __gdb_stack + DBG_STACK_SIZE
 	ld	hl, (__gdb_state + R_PC)
-	push	hl	/* resume address */
-#ifdef __SDCC_ez80_adl
-	ld	hl, 0xc30000 ; use 0xc34000 for jp.s
-#else
-	ld	hl, 0xc300
-#endif
-	push	hl	/* JP opcode */
+	ld	(_trampoline + 1), hl	/* resume address */
+	ld	a, 0xc3
+	ld	(_trampoline), a	/* JP opcode */
 #endif /* DBG_USE_TRAMPOLINE */
 	ld	hl, (__gdb_state + R_AF_)
 	push	hl
@@ -997,11 +3898,7 @@ void _gdb_rest_cpu_state() __naked {
 	DBG_RESUME
 #else
 	ld	hl, (__gdb_state + R_HL)
-#ifdef __SDCC_ez80_adl
-	jp	_gdb_stack + DBG_STACK_SIZE - 4
-#else
-	jp	_gdb_stack + DBG_STACK_SIZE - 3
-#endif
+	jp	_trampoline
 #endif /* DBG_USE_TRAMPOLINE */
   __endasm;
 }
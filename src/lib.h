@@ -36,7 +36,8 @@ typedef unsigned short word;
      and all required macros and then include this file to one of your C-source
      files.
   3. Implement gdb_getDebugChar() and gdb_putDebugChar(), functions must not return
-     until data received or sent.
+     until data received or sent. With DBG_TRANSPORT set the transport
+     callbacks at run time instead (gdb_set_get_char(), gdb_set_read(), ...).
   4. Implement all optional functions used to toggle breakpoints/watchpoints,
      if supported. Do not write fuctions to toggle software breakpoints if
      you unsure (GDB will do itself).
@@ -80,6 +81,43 @@ typedef unsigned short word;
 */
 #define DBG_TOGGLESTEP _gdb_toggle_step
 
+/* Uncomment to keep software breakpoints set by GDB in a table of the stub
+   instead of calling the function to toggle them. The value is the maximal
+   number of breakpoints. The stub writes call _gdb_swbreak (or RST with
+   DBG_SWBREAK_RST) itself when the program is resumed and restores memory
+   when the stub is entered, so Z0 and z0 packets do not write memory.
+   Breakpoints in unwritable memory are silently skipped. */
+//#define DBG_SWBREAK_TABLE 16
+
+/* Uncomment to step in the stub when no function to toggle stepping is set:
+   the instruction at PC is decoded and a temporary software breakpoint
+   (call _gdb_swbreak, or RST with DBG_SWBREAK_RST) is written at the next
+   instruction to be executed. Conditions of jumps, calls and returns are
+   evaluated from saved registers. Calls into unwritable memory are stepped
+   over. Requires DBG_SWBREAK, not available for gbz80 and ez80 ADL mode. */
+//#define DBG_SOFTSTEP
+
+/* Uncomment to evaluate conditions of breakpoints in the stub. GDB sends
+   them as agent expressions with Z0/Z1 packets, the stub resumes at once
+   stepping over the breakpoint when all of them are false. Up to
+   DBG_COND_COUNT breakpoints may have conditions of DBG_COND_SIZE bytes in
+   total. Requires DBG_SOFTSTEP. */
+//#define DBG_COND
+//#define DBG_COND_COUNT 4
+//#define DBG_COND_SIZE 32
+
+/* Uncomment to support tracepoints (tstart, tfind). Each hit of one of
+   DBG_TRACE_COUNT tracepoints stores registers and up to DBG_TRACE_MEM
+   memory ranges to the ring buffer of DBG_TRACE_BUFFER bytes and the program
+   continues at once. While a frame is selected by tfind, g, m and x read
+   the frame. Registers are always collected, expressions and while-stepping
+   actions are ignored. Tracepoints share DBG_SWBREAK_TABLE with breakpoints
+   of GDB. Requires DBG_SOFTSTEP and DBG_SWBREAK_TABLE. */
+//#define DBG_TRACE
+//#define DBG_TRACE_COUNT 4
+//#define DBG_TRACE_MEM 2
+//#define DBG_TRACE_BUFFER 512
+
 /* Define if one of standard RST handlers is used as software
    breakpoint entry point */
 //#define DBG_SWBREAK_RST 0x08
@@ -119,7 +157,9 @@ typedef unsigned short word;
  */
 //#define DBG_MEMCPY memcpy
 
-/* define dedicated stack size if required */
+/* define dedicated stack size if required
+   0 means that the stack is set by gdb_set_stack() before the stub is entered
+*/
 //#define DBG_STACK_SIZE 256
 
 /* max GDB packet size
@@ -127,17 +167,108 @@ typedef unsigned short word;
 */
 #define DBG_PACKET_SIZE 800
 
+/* Uncomment to use the packet buffer set by gdb_set_buffer() instead of
+   DBG_PACKET_SIZE bytes allocated on stack. Packet size is the size of the
+   buffer minus one then. The program is resumed at once until the buffer is set.
+*/
+//#define DBG_RUNTIME_BUFFER
+
+/* Uncomment to send replies to g, m and x packets straight from memory
+   instead of rendering them into the packet buffer first. Memory reads are
+   not limited by DBG_PACKET_SIZE then: use "set remote memory-read-packet-size"
+   to read larger blocks at once. */
+//#define DBG_STREAM
+
+/* Uncomment to write payload of X and M packets straight to memory while
+   the packet is received instead of buffering it first. X and M packets
+   are not limited by DBG_PACKET_SIZE then. If DBG_STREAM is enabled too,
+   GDB is told the packet size is DBG_STREAM_PACKET_SIZE, so both loads and
+   dumps use large packets, unless DBG_FLASH needs the buffer for them. */
+//#define DBG_STREAM_WRITE
+//#define DBG_STREAM_PACKET_SIZE 4096
+
 /* Uncomment if required to use trampoline when resuming operation.
-   Useful with dedicated stack when stack pointer do not point to the stack or
-   stack is not writable */
+   Useful when stack pointer do not point to the stack or stack is not
+   writable. The JP instruction is kept in a static 3 byte (4 on eZ80) area */
 //#define DBG_USE_TRAMPOLINE
 
+/* Comment this line out to send packets without run-length encoding.
+   Runs of 4 and more repeated characters are sent as "c*n", which greatly
+   reduces size of zero filled memory dumps and register packets. */
+#define DBG_RLE
+
+/* Registers sent in stop replies: bit n is register n in the order of
+   g packet (AF, BC, DE, HL, SP, PC, IX, IY, AF', BC', DE', HL', IR). GDB
+   reads all registers after a stop unless they are sent, all are sent by
+   default. 0x0031 sends AF, SP and PC only, which keeps replies short. */
+//#define DBG_EXPEDITE 0x0031
+
+/* Uncomment to set transport functions at run time instead of defining
+   gdb_getDebugChar() and gdb_putDebugChar(). Either byte callbacks
+   (gdb_set_get_char/gdb_set_put_char) or block callbacks (gdb_set_read/
+   gdb_set_write) may be used for each direction. With block write, outgoing
+   bytes are collected in a buffer of DBG_TX_BUFFER_SIZE bytes which is
+   flushed once per packet. Block read must return number of bytes read,
+   at least one, and should not wait for more than already available.
+   Both buffers are limited to 255 bytes. */
+//#define DBG_TRANSPORT
+//#define DBG_TX_BUFFER_SIZE 32
+//#define DBG_RX_BUFFER_SIZE 32
+
+/* Uncomment to use hand written table driven Z80 loops in place of C
+   functions converting memory to hex and back in g, G, m and M packets,
+   streamed replies of DBG_STREAM included. The inner loops take 185 T-states
+   per byte encoding and 193 decoding by instruction timings, but add about
+   200 bytes of code. The T/byte column of "make ticks" gives the whole cost
+   of m and M per byte, compare it with "make ticks CFLAGS=-DDBG_FAST_HEX".
+   Not available for gbz80. */
+//#define DBG_FAST_HEX
+
+/* Uncomment to compute CRC-32 for qCRC packets (compare-sections) using
+   a table of 256 entries (1 KiB) instead of 16 entries. It is about twice
+   as fast. */
+//#define DBG_CRC_TABLE
+
+/* Uncomment to call _gdb_ticks_mark(id) at the measurement points of the
+   stub (see DBG_TICKS_ENTER and below). It is used by "make ticks" to count
+   T-states spent in each stage of packet handling under z88dk-ticks. */
+//#define DBG_TICKS
+
 /* Uncomment following macro to enable debug printing to debugger console */
 #define DBG_PRINT
 
 #define DBG_NMI_EX EX_HWBREAK
 #define DBG_INT_EX EX_SIGINT
 
+/* Uncomment to read memory without stopping the program. When gdb_int is
+   entered with '$' pending on the line, m, x and qCRC packet is answered
+   and the program continues, any other packet gets empty reply. Other
+   characters (0x03 from GDB) stop the program as usual. */
+//#define DBG_LIVE
+
+/* Uncomment to sample PC of the running program: jump to gdb_sample from
+   a periodic INT handler and every sample increments a counter of
+   1 << DBG_PROFILER_SHIFT bytes of the address space. "monitor prof start",
+   "monitor prof stop" and "monitor prof" start, stop and print the histogram
+   (see tools/profile.py). Not available for gbz80 and ez80 ADL mode. */
+//#define DBG_PROFILER
+//#define DBG_PROFILER_SHIFT 8
+
+/* Uncomment to count packets, bytes, rejected packets and commands. "monitor
+   stats" prints the counters and "monitor stats reset" clears them. Time
+   spent in the stub is counted too if gdb_set_ticks() gives a timer. */
+//#define DBG_STATS
+
+/* Uncomment to stop waiting for the rest of a packet or for the
+   acknowledgement of a reply after DBG_TIMEOUT timeouts of the receive
+   function: gdb_set_get_char_timeout() function returning -1 or block read
+   function returning 0 when nothing comes in a short time the program
+   chooses. A half received packet is dropped and the stub waits for next
+   '$', a reply is sent again and dropped after DBG_RETRIES retransmits.
+   Waiting for a new packet is never timed out. */
+//#define DBG_TIMEOUT 10
+//#define DBG_RETRIES 4
+
 /* Define following macro to statement, which will be exectuted after entering to
    _gdb_stub_main function. Statement should include semicolon. */
 #define DBG_ENTER if(_gdb_enter_func) { _gdb_enter_func(); };
@@ -161,7 +292,31 @@ typedef unsigned short word;
 "
 */
 
-/* Define following macro to the string containing feature definition XML. */
+/* Uncomment to program flash regions of the memory map by "load" command:
+   vFlashErase, vFlashWrite and vFlashDone packets call the functions set
+   by gdb_set_flash(). Written data is collected in blocks of DBG_FLASH
+   bytes (power of 2, usually blocksize of the region), so each block is
+   programmed once however GDB splits the data between packets. Flash is
+   programmed only from packets with the right checksum, so vFlashWrite is
+   never streamed and packets are limited by the packet buffer even with
+   DBG_STREAM and DBG_STREAM_WRITE. */
+//#define DBG_FLASH 128
+
+/* Uncomment to accept "QLZ4:addr,length:data" packets which write length
+   bytes at addr decoded from the LZ4 block in binary data. tools/lz4load.py
+   adds "lz4-load" command to GDB which loads a program with them. */
+//#define DBG_LZ4
+
+/* Define following macro to the string containing feature definition XML.
+   With DBG_FEATURE_SHORT only the architecture is described, GDB uses its
+   own Z80 register set then, which is the same. It is 63 bytes long instead
+   of about 700, so it takes a single qXfer reply with any packet size. */
+//#define DBG_FEATURE_SHORT
+#ifdef DBG_FEATURE_SHORT
+#define DBG_FEATURE_STR "<target version=\"1.0\">"\
+"<architecture>z80</architecture>"\
+"</target>"
+#else
 #define DBG_FEATURE_STR "<target version=\"1.0\">"\
 "<feature name=\"org.gnu.gdb.z80.cpu\">"\
 "<reg name=\"af\" bitsize=\"16\" type=\"int\"/>"\
@@ -180,6 +335,7 @@ typedef unsigned short word;
 "</feature>"\
 "<architecture>z80</architecture>"\
 "</target>"
+#endif /* DBG_FEATURE_SHORT */
 
 #endif /* DBG_CONFIGURED */
 /******************************************************************************\
@@ -243,20 +399,36 @@ typedef unsigned short word;
 #endif /*__SDCC_gbz80 */
 extern byte _gdb_state[NUMREGBYTES];
 
+#ifndef DBG_EXPEDITE
+#define DBG_EXPEDITE ((1U << (NUMREGBYTES/REG_SIZE)) - 1)
+#endif
+
+/* packet buffer must hold g reply and stop reply with all registers */
+#define MIN_PACKET_SIZE (NUMREGBYTES/REG_SIZE*(4+2*REG_SIZE) + 24)
+
 void _gdb_save_cpu_state (void);
 void _gdb_rest_cpu_state (void);
 void _gdb_stub_main (int sigval, int pc_adj);
+void _gdb_live_main (int sigval, int pc_adj);
 
 /* dedicated stack */
 #ifdef DBG_STACK_SIZE
 
+#ifdef __SDCC_gbz80
+#if DBG_STACK_SIZE == 0
+#error "gdb_set_stack() is not available for gbz80"
+#endif
+/* there is no LD SP,(nn) */
 #define LOAD_SP	ld	sp, __gdb_stack + DBG_STACK_SIZE
+#else
+#define LOAD_SP	ld	sp, (__gdb_stack_top)
+extern char *_gdb_stack_top;
+#endif /* __SDCC_gbz80 */
 
-static char _gdb_stack[DBG_STACK_SIZE];
+extern char _gdb_stack[];
 
 #else
 
-#undef DBG_USE_TRAMPOLINE
 #define LOAD_SP
 
 #endif
@@ -275,4 +447,74 @@ extern int (*_gdb_toggle_swbreak)(int set, void *addr);
 
 #ifdef DBG_ENTER
 extern void (*_gdb_enter_func)(void);
+#endif
+
+#if defined(DBG_PROFILER) && (defined(__SDCC_gbz80) || \
+    defined(__SDCC_ez80_adl) || defined(DBG_MIN_SIZE))
+#undef DBG_PROFILER
+#endif
+
+#if defined(DBG_LIVE) && defined(DBG_MIN_SIZE)
+#undef DBG_LIVE
+#endif
+
+#if defined(DBG_FLASH) && defined(DBG_MIN_SIZE)
+#undef DBG_FLASH
+#endif
+
+#if defined(DBG_STATS) && defined(DBG_MIN_SIZE)
+#undef DBG_STATS
+#endif
+
+#ifdef DBG_STATS
+extern word (*_gdb_ticks)(void);
+#endif
+
+#ifdef DBG_TIMEOUT
+#ifndef DBG_RETRIES
+#define DBG_RETRIES 4
+#endif
+extern int (*_gdb_get_char_timeout)(void);
+#endif
+
+#ifdef DBG_FLASH
+extern int (*_gdb_flash_erase)(void *addr, unsigned len);
+extern int (*_gdb_flash_program)(void *addr, const void *data, unsigned len);
+#endif
+
+#ifdef DBG_PROFILER
+#ifndef DBG_PROFILER_SHIFT
+#define DBG_PROFILER_SHIFT 8
+#endif
+#define DBG_PROFILER_BUCKETS (0x10000UL >> DBG_PROFILER_SHIFT)
+extern byte _gdb_prof_on;
+extern word _gdb_prof_hist[DBG_PROFILER_BUCKETS];
+#endif
+
+#ifdef DBG_TICKS
+/* measurement points, pairs of BEGIN and BEGIN_END are around the call */
+#define DBG_TICKS_ENTER		1	/* CPU state saved, stub entered */
+#define DBG_TICKS_LEAVE		2	/* before CPU state is restored */
+#define DBG_TICKS_GET_PACKET	3
+#define DBG_TICKS_GET_PACKET_END 4
+#define DBG_TICKS_PROCESS	5	/* around do_process() */
+#define DBG_TICKS_PROCESS_END	6
+#define DBG_TICKS_PUT_PACKET	7
+#define DBG_TICKS_PUT_PACKET_END 8
+void _gdb_ticks_mark (byte id) FASTCALL;
+#define DBG_TICKS_MARK(id) _gdb_ticks_mark (id)
+#else
+#define DBG_TICKS_MARK(id)
+#endif
+
+#ifdef DBG_RUNTIME_BUFFER
+extern char *_gdb_buffer;
+extern unsigned _gdb_packet_size;
+#endif
+
+#ifdef DBG_TRANSPORT
+extern unsigned char (*_gdb_get_char)(void);
+extern void (*_gdb_put_char)(unsigned char ch);
+extern unsigned (*_gdb_read)(unsigned char *buf, unsigned n);
+extern void (*_gdb_write)(const unsigned char *buf, unsigned n);
 #endif
\ No newline at end of file
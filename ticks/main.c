@@ -0,0 +1,229 @@
+/* T-states profiling of the stub under z88dk-ticks.
+
+   Copyright (C) 2022 Empathic Qubit.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* Test program linked with gdb.lib built with DBG_TICKS. It enters the stub
+   once, feeds packet number TICKS_PACKET from a scripted serial port and
+   resumes with "c". For every stage of handling of that packet there is
+   a pair of empty functions ticks_begin_<stage> and ticks_end_<stage>,
+   which are called when the stage starts and ends. ticks/ticks.sh runs
+   z88dk-ticks with -start and -end set to addresses of each pair.
+
+   Stages:
+     save	- from the call of gdb_exception() to _gdb_stub_main()
+     get	- get_packet() of the packet
+     process	- do_process() of the packet
+     put	- put_packet() of the reply
+     rest	- from _gdb_rest_cpu_state() to the instruction after the call
+     cal	- two consecutive marks, overhead of a measurement */
+
+#include <string.h>
+
+#include "gdb.h"
+
+#ifndef TICKS_PACKET
+#define TICKS_PACKET 0
+#endif
+
+#define TICKS_CAL	0x80
+#define TICKS_CAL_END	0x81
+
+/* packet names reported by ticks/ticks.sh */
+/* 0 - ?, 1 - g, 2 - G, 3 - m, 4 - M, 5 - x, 6 - X, 7 - Z0, 8 - z0,
+   9 - qSupported */
+
+#define AREA_SIZE 128
+
+static byte area[AREA_SIZE];
+static const byte area_size = AREA_SIZE;
+static char script[DBG_PACKET_SIZE];
+static const char *script_pos;
+static char *script_end;
+static byte received;
+
+void ticks_begin_save (void) {}
+void ticks_end_save (void) {}
+void ticks_begin_get (void) {}
+void ticks_end_get (void) {}
+void ticks_begin_process (void) {}
+void ticks_end_process (void) {}
+void ticks_begin_put (void) {}
+void ticks_end_put (void) {}
+void ticks_begin_rest (void) {}
+void ticks_end_rest (void) {}
+void ticks_begin_cal (void) {}
+void ticks_end_cal (void) {}
+void ticks_done (void) {}
+
+void _gdb_ticks_mark (byte id) FASTCALL {
+  switch (id)
+    {
+    case DBG_TICKS_ENTER:
+      ticks_end_save ();
+      return;
+    case DBG_TICKS_LEAVE:
+      ticks_begin_rest ();
+      return;
+    case TICKS_CAL:
+      ticks_begin_cal ();
+      return;
+    case TICKS_CAL_END:
+      ticks_end_cal ();
+      return;
+    case DBG_TICKS_GET_PACKET:
+      ++received;
+      break;
+    }
+  /* the stop reply is sent before the packet is received and
+     the resume packet is received after */
+  if (received != 1)
+    return;
+  switch (id)
+    {
+    case DBG_TICKS_GET_PACKET: ticks_begin_get (); break;
+    case DBG_TICKS_GET_PACKET_END: ticks_end_get (); break;
+    case DBG_TICKS_PROCESS: ticks_begin_process (); break;
+    case DBG_TICKS_PROCESS_END: ticks_end_process (); break;
+    case DBG_TICKS_PUT_PACKET: ticks_begin_put (); break;
+    case DBG_TICKS_PUT_PACKET_END: ticks_end_put (); break;
+    }
+}
+
+unsigned char gdb_getDebugChar (void) FASTCALL {
+  return *script_pos++;
+}
+
+void gdb_putDebugChar (unsigned char ch) FASTCALL {
+  (void)ch;
+}
+
+static int toggle_swbreak (int set, void *addr) {
+  (void)set;
+  (void)addr;
+  return 0;
+}
+
+static char *put_hex (char *p, const byte *mem, unsigned n) {
+  for (; n != 0; --n, ++mem)
+    {
+      *p++ = "0123456789abcdef"[*mem >> 4];
+      *p++ = "0123456789abcdef"[*mem & 15];
+    }
+  return p;
+}
+
+static char *put_addr (char *p, const void *addr) {
+  const unsigned v = (unsigned)addr;
+  byte b[2];
+  b[0] = v >> 8;
+  b[1] = v & 0xff;
+  return put_hex (p, b, 2);
+}
+
+/* frame text from start to end as a packet */
+static char *frame (char *start, char *end) {
+  byte csum = 0;
+  char *p;
+  memmove (start + 1, start, end - start);
+  *start = '$';
+  for (p = start + 1; p <= end; ++p)
+    csum += *p;
+  *p++ = '#';
+  return put_hex (p, &csum, 1);
+}
+
+/* called by the stub right after the CPU state is saved, so G packet can
+   write back the same register values */
+static void build_script (void) {
+  char *p = script;
+  char *start;
+  *p++ = '+'; /* acknowledge stop reply */
+  start = p;
+  switch (TICKS_PACKET)
+    {
+    case 0:
+      *p++ = '?';
+      break;
+    case 1:
+      *p++ = 'g';
+      break;
+    case 2:
+      *p++ = 'G';
+      p = put_hex (p, _gdb_state, NUMREGBYTES);
+      break;
+    case 3:
+    case 4:
+      *p++ = TICKS_PACKET == 3 ? 'm' : 'M';
+      p = put_addr (p, area);
+      *p++ = ',';
+      p = put_hex (p, &area_size, 1);
+      if (TICKS_PACKET == 4)
+        {
+          *p++ = ':';
+          p = put_hex (p, area, AREA_SIZE);
+        }
+      break;
+    case 5:
+    case 6:
+      *p++ = TICKS_PACKET == 5 ? 'x' : 'X';
+      p = put_addr (p, area);
+      *p++ = ',';
+      p = put_hex (p, &area_size, 1);
+      if (TICKS_PACKET == 6)
+        {
+          *p++ = ':';
+          memset (p, 'U', AREA_SIZE);
+          p += AREA_SIZE;
+        }
+      break;
+    case 7:
+    case 8:
+      *p++ = TICKS_PACKET == 7 ? 'Z' : 'z';
+      *p++ = '0';
+      *p++ = ',';
+      p = put_addr (p, area);
+      *p++ = ',';
+      *p++ = '3';
+      break;
+    default:
+      strcpy (p, "qSupported:swbreak+;hwbreak+");
+      p += strlen (p);
+      break;
+    }
+  p = frame (start, p);
+  *p++ = '+'; /* acknowledge reply */
+  start = p;
+  *p++ = 'c';
+  p = frame (start, p);
+  *p++ = '+'; /* never read if the stub resumes as expected */
+  script_end = p;
+  script_pos = script;
+}
+
+int main (void) {
+  memset (area, 0x5a, sizeof(area));
+  gdb_set_swbreak_toggle (toggle_swbreak);
+  gdb_set_hwbreak_toggle (toggle_swbreak);
+  gdb_set_enter (build_script);
+  _gdb_ticks_mark (TICKS_CAL);
+  _gdb_ticks_mark (TICKS_CAL_END);
+  ticks_begin_save ();
+  gdb_exception (EX_SWBREAK);
+  ticks_end_rest ();
+  ticks_done ();
+  /* everything except the last acknowledgement must be read */
+  return script_pos + 1 == script_end ? 0 : 1;
+}
@@ -0,0 +1,52 @@
+#!/usr/bin/env bash
+# Report T-states spent by the stub per packet type, see ticks/main.c
+#
+# Usage: ticks.sh BUILD_DIR
+#   BUILD_DIR must contain gdb.lib compiled for +test with -DDBG_TICKS.
+#   CC, TICKS and CFLAGS may be set in the environment.
+
+set -e
+
+build="$1"
+src="$(dirname "$0")/../src"
+CC="${CC:-$(which zcc z88dk.zcc | head -1)}"
+TICKS="${TICKS:-$(which z88dk-ticks z88dk.z88dk-ticks | head -1)}"
+packets=('?' g G m M x X Z0 z0 qSupported)
+# data bytes of the packet, see AREA_SIZE of ticks/main.c
+bytes=(0 0 0 128 128 128 128 0 0 0)
+stages=(save get process put rest)
+
+# address of the symbol in the map file as hexadecimal number
+symbol () {
+	awk -v name="_$2" '$1 == name { sub(/^\$/, "", $3); print $3; exit }' "$1"
+}
+
+# T-states between the calls of ticks_begin_$2 and ticks_end_$2
+measure () {
+	local start end
+	start=$(symbol "$1.map" "ticks_begin_$2")
+	end=$(symbol "$1.map" "ticks_end_$2")
+	"$TICKS" -start "$start" -end "$end" "$1.bin" | grep -o '[0-9]\+' | tail -1
+}
+
+printf '%-12s' packet
+printf '%10s' "${stages[@]}"
+printf '%10s\n' T/byte
+for i in "${!packets[@]}"; do
+	out="$build/ticks_$i"
+	"$CC" +test $CFLAGS -DDBG_TICKS -DTICKS_PACKET=$i -I"$src" -m \
+		-o "$out.bin" "$(dirname "$0")/main.c" -L"$build" -lgdb
+	cal=$(measure "$out" cal)
+	printf '%-12s' "${packets[$i]}"
+	total=0
+	for stage in "${stages[@]}"; do
+		t=$(( $(measure "$out" $stage) - cal ))
+		printf '%10d' $t
+		case $stage in get|process|put) total=$(( total + t ));; esac
+	done
+	# receiving, processing and replying divided by data bytes
+	if [ "${bytes[$i]}" -ne 0 ]; then
+		printf '%10d' $(( total / bytes[i] ))
+	fi
+	printf '\n'
+done
@@ -0,0 +1,199 @@
+#!/usr/bin/env python3
+# Compressed program load for the stub built with DBG_LZ4.
+#
+# Copyright (C) 2022 Empathic Qubit.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Load a program with "QLZ4:addr,length:data" packets.
+
+In GDB (version 13 or later, for send_packet of Python API):
+    source tools/lz4load.py
+    lz4-load                    loadable segments of the executable (ELF)
+    lz4-load prog.elf           loadable segments of prog.elf
+    lz4-load prog.bin 0x9000    raw binary at 0x9000
+Each packet carries an LZ4 block, which the stub decodes into memory, so
+the link carries only the compressed data. Like "load", PC is set to the
+entry point of an ELF file.
+
+Outside GDB the same arguments report the packets which would be sent:
+    lz4load.py prog.bin 0x9000
+"""
+
+import struct
+import sys
+
+PT_LOAD = 1
+# largest header: QLZ4:ffff,ffff:
+HEADER_SIZE = 16
+
+
+def read_elf(data):
+    """Return entry point and list of (address, bytes) of loadable segments."""
+    if data[:4] != b'\x7fELF' or data[4] != 1 or data[5] != 1:
+        raise ValueError('not a little endian 32-bit ELF file')
+    entry, phoff = struct.unpack_from('<II', data, 24)
+    phentsize, phnum = struct.unpack_from('<HH', data, 42)
+    segments = []
+    for i in range(phnum):
+        (p_type, offset, _, paddr, filesz, _, _, _) = struct.unpack_from(
+            '<IIIIIIII', data, phoff + i * phentsize)
+        if p_type == PT_LOAD and filesz != 0:
+            segments.append((paddr, data[offset:offset + filesz]))
+    return entry, segments
+
+
+def read_program(path, address=None):
+    with open(path, 'rb') as f:
+        data = f.read()
+    if address is None:
+        return read_elf(data)
+    return None, [(address, data)]
+
+
+def lz4_put_len(out, n):
+    while n >= 255:
+        out.append(255)
+        n -= 255
+    out.append(n)
+
+
+def lz4_put_seq(out, literals, offset, match):
+    token = len(out)
+    out.append(min(len(literals), 15) << 4)
+    if len(literals) >= 15:
+        lz4_put_len(out, len(literals) - 15)
+    out += literals
+    if match == 0:
+        return
+    out += struct.pack('<H', offset)
+    out[token] |= min(match - 4, 15)
+    if match - 4 >= 15:
+        lz4_put_len(out, match - 4 - 15)
+
+
+def lz4_compress(src):
+    """Greedy LZ4 block compressor. The last 5 bytes are literals and the
+    last match starts 12 bytes before the end at least, as the format says."""
+    out = bytearray()
+    head = {}
+    n = len(src)
+    i = anchor = 0
+    while i + 12 <= n:
+        key = src[i:i + 4]
+        cand = head.get(key)
+        head[key] = i
+        if cand is None or i - cand > 0xffff:
+            i += 1
+            continue
+        length = 4
+        while i + length < n - 5 and src[cand + length] == src[i + length]:
+            length += 1
+        lz4_put_seq(out, src[anchor:i], i - cand, length)
+        i += length
+        anchor = i
+    lz4_put_seq(out, src[anchor:], 0, 0)
+    return bytes(out)
+
+
+def lz4_packets(address, data, packet_size):
+    """Yield (address, length, packet) covering data, every packet has less
+    than packet_size bytes before escaping."""
+    pos = 0
+    while pos < len(data):
+        size = min(len(data) - pos, 0xffff)
+        while True:
+            block = lz4_compress(data[pos:pos + size])
+            header = b'QLZ4:%x,%x:' % (address + pos, size)
+            if len(header) + len(block) < packet_size:
+                break
+            # shrink in proportion to the excess
+            size = max(1, min(size - 1, size * (packet_size - HEADER_SIZE) // len(block)))
+        yield address + pos, size, header + block
+        pos += size
+
+
+def escape(packet):
+    out = bytearray()
+    for b in packet:
+        if b in b'$#}*':
+            out += bytes((0x7d, b ^ 0x20))
+        else:
+            out.append(b)
+    return bytes(out)
+
+
+def report(args):
+    if len(args) not in (1, 2):
+        sys.exit(__doc__)
+    address = int(args[1], 0) if len(args) == 2 else None
+    _, segments = read_program(args[0], address)
+    raw = sent = 0
+    for start, data in segments:
+        for addr, size, packet in lz4_packets(start, data, 800):
+            print('%04x %5d bytes in %4d byte packet' % (addr, size, len(packet)))
+            raw += size
+            sent += len(escape(packet)) + 4
+    if raw:
+        print('%d bytes in %d bytes, %.1f%%' % (raw, sent, 100.0 * sent / raw))
+
+
+try:
+    import gdb
+except ImportError:
+    gdb = None
+
+if gdb is not None:
+    class Lz4Load(gdb.Command):
+        """Load the program with LZ4 compressed packets.
+Usage: lz4-load [FILE [ADDRESS]]
+Without ADDRESS FILE is an ELF file, the current executable by default."""
+
+        def __init__(self):
+            super().__init__('lz4-load', gdb.COMMAND_FILES, gdb.COMPLETE_FILENAME)
+
+        @staticmethod
+        def send(conn, packet):
+            reply = conn.send_packet(escape(packet))
+            return reply.decode('latin-1') if isinstance(reply, bytes) else reply
+
+        def invoke(self, arg, from_tty):
+            args = gdb.string_to_argv(arg)
+            if not args:
+                args = [gdb.current_progspace().filename]
+            address = int(gdb.parse_and_eval(args[1])) if len(args) > 1 else None
+            entry, segments = read_program(args[0], address)
+            conn = gdb.selected_inferior().connection
+            reply = self.send(conn, b'qLZ4')
+            if not reply or reply.startswith('E'):
+                raise gdb.GdbError('the stub is built without DBG_LZ4')
+            packet_size = int(reply, 16)
+            for start, data in segments:
+                sent = 0
+                for addr, size, packet in lz4_packets(start, data, packet_size):
+                    reply = self.send(conn, packet)
+                    if reply != 'OK':
+                        raise gdb.GdbError('writing 0x%x bytes at 0x%04x: %s' %
+                                           (size, addr, reply))
+                    sent += len(packet)
+                print('Loading 0x%04x, size 0x%x, %d bytes sent' %
+                      (start, len(data), sent))
+            # memory has changed behind GDB
+            gdb.execute('maintenance flush dcache', to_string=True)
+            if entry is not None:
+                gdb.execute('set $pc = 0x%x' % entry)
+
+    Lz4Load()
+elif __name__ == '__main__':
+    report(sys.argv[1:])
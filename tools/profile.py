@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+# Report of PC samples collected by the stub built with DBG_PROFILER.
+#
+# Copyright (C) 2022 Empathic Qubit.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Turn the output of "monitor prof" into a flat profile.
+
+Save the histogram from GDB, for example
+    gdb -batch -ex 'target remote :9999' -ex 'monitor prof' > prof.txt
+and run
+    profile.py prof.txt program.map
+The histogram consists of "prof SHIFT" line followed by "ADDRESS COUNT"
+lines, all numbers are hexadecimal. Samples of each area of 1 << SHIFT
+bytes are divided between functions of the z88dk map file which overlap
+it in proportion to the size of the overlap. --folded prints
+"function count" lines accepted by flamegraph.pl.
+"""
+
+import argparse
+import re
+import sys
+
+MAP_LINE = re.compile(
+    r'^(\S+)\s*=\s*\$([0-9A-Fa-f]+)\s*;\s*(\w+)\s*,\s*(\w*)\s*,[^,]*,[^,]*,\s*([^,\s]*)')
+PROF_LINE = re.compile(r'^prof ([0-9A-Fa-f]+)\s*$')
+SAMPLE_LINE = re.compile(r'^([0-9A-Fa-f]{4}) ([0-9A-Fa-f]{4})\s*$')
+DATA_SECTIONS = ('data', 'bss', 'rodata')
+
+
+def read_histogram(f):
+    shift = None
+    samples = []
+    for line in f:
+        m = PROF_LINE.match(line)
+        if m:
+            shift = int(m.group(1), 16)
+            samples = []
+            continue
+        m = SAMPLE_LINE.match(line)
+        if m and shift is not None:
+            samples.append((int(m.group(1), 16), int(m.group(2), 16)))
+    if shift is None:
+        sys.exit('profile.py: no "prof" line in the histogram')
+    return shift, samples
+
+
+def read_symbols(f, all_labels):
+    """Return sorted list of (address, name) of code symbols."""
+    symbols = {}
+    for line in f:
+        m = MAP_LINE.match(line)
+        if not m:
+            continue
+        name, addr, kind, scope, section = m.groups()
+        if kind != 'addr' or section.startswith(DATA_SECTIONS):
+            continue
+        if not all_labels and scope != 'public' and not name.startswith('_'):
+            continue
+        # C functions are prefixed by underscore
+        symbols.setdefault(int(addr, 16), name[1:] if name.startswith('_') else name)
+    return sorted(symbols.items())
+
+
+def attribute(shift, samples, symbols):
+    """Return dictionary of samples per function."""
+    size = 1 << shift
+    bounds = [a for a, _ in symbols] + [0x10000]
+    counts = {}
+    for start, count in samples:
+        end = start + size
+        # symbols are few, linear search is fast enough
+        for i, (addr, name) in enumerate(symbols):
+            lo = max(start, addr)
+            hi = min(end, bounds[i + 1])
+            if lo < hi:
+                counts[name] = counts.get(name, 0) + count * (hi - lo) / size
+        if start < symbols[0][0]:
+            hi = min(end, symbols[0][0])
+            counts['??'] = counts.get('??', 0) + count * (hi - start) / size
+    return counts
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('histogram', help='output of "monitor prof", - for stdin')
+    parser.add_argument('map', nargs='?', help='z88dk map file of the program')
+    parser.add_argument('--folded', action='store_true',
+                        help='print folded stacks for flamegraph.pl')
+    parser.add_argument('--all-labels', action='store_true',
+                        help='use local labels of the map file too')
+    args = parser.parse_args()
+
+    if args.histogram == '-':
+        shift, samples = read_histogram(sys.stdin)
+    else:
+        with open(args.histogram) as f:
+            shift, samples = read_histogram(f)
+    symbols = []
+    if args.map:
+        with open(args.map) as f:
+            symbols = read_symbols(f, args.all_labels)
+    if symbols:
+        counts = attribute(shift, samples, symbols)
+    else:
+        # no map: report areas of the histogram
+        counts = dict(('%04x' % a, c) for a, c in samples)
+    total = sum(counts.values())
+    ranked = sorted(counts.items(), key=lambda kv: kv[1], reverse=True)
+
+    if args.folded:
+        for name, count in ranked:
+            if round(count) > 0:
+                print('%s %d' % (name, round(count)))
+        return
+    print('Flat profile: %d samples, %d bytes per sample area' % (total, 1 << shift))
+    print()
+    print('  %  cumulative      self')
+    print(' time   samples   samples  name')
+    cumulative = 0
+    for name, count in ranked:
+        cumulative += count
+        print('%5.1f %9.0f %9.0f  %s' % (100.0 * count / total if total else 0,
+                                         cumulative, count, name))
+
+
+if __name__ == '__main__':
+    main()